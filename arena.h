@@ -6,24 +6,128 @@
 #error "ARENA_TYPE must be defined before including arena.h"
 #else
 
+#ifndef ARENA_FOREACH
+// Runs the body with e pointing at every live element of arena, in index order.
+// One loop steps through the live bits of a word, moving to the next word with
+// a live slot when they run out. The inner loop only binds e and runs once, a
+// break leaves arena_brk set so the outer loop stops too.
+#define ARENA_FOREACH(arena, e) \
+    for (U64 CAT2(arena_w, __LINE__) = 0, \
+            CAT2(arena_live, __LINE__) = (arena)->tracking.element_num == 0 ? 0 : arena_live_word(&(arena)->tracking, 0), \
+            CAT2(arena_brk, __LINE__) = 0; \
+            CAT2(arena_brk, __LINE__) == 0 && (CAT2(arena_live, __LINE__) != 0 \
+                || (CAT2(arena_live, __LINE__) = arena_live_word_next(&(arena)->tracking, &CAT2(arena_w, __LINE__))) != 0); \
+            CAT2(arena_live, __LINE__) &= CAT2(arena_live, __LINE__) - 1) \
+        for (__typeof__((arena)->backing) e = (CAT2(arena_brk, __LINE__) = 1, \
+                &(arena)->backing[CAT2(arena_w, __LINE__) * 64 + lowest_bit_idx(CAT2(arena_live, __LINE__))]); \
+                CAT2(arena_brk, __LINE__) != 0; CAT2(arena_brk, __LINE__) = 0)
+#endif
+
 #define NAME(a) CAT2(a, ARENA_TYPE)
 
 #define ARENA NAME(Arena)
 
+// backing is reserved for ARENA_MAX_ELEMENTS and committed along with tracking
 typedef struct {
     ArenaTracking tracking;
     ARENA_TYPE* backing;
+    U32 committed;
+    VmFile file;                    // fd is -1 unless made by arena_create_snapshot
+    ArenaIdx saved_element_num;
 } ARENA;
 
+// Flags apply to tracking and backing, see VmFlags.
+// tracking.free is NULL on failure.
+ARENA NAME(arena_create_flags)(VmFlags flags) {
+    ArenaTracking tracking = arena_tracking_create_flags(flags);
+    if (tracking.free == NULL) { return (ARENA) { .tracking = tracking, .file = { .fd = -1 } }; }
+
+    ARENA_TYPE* backing = vm_reserve_flags(ARENA_MAX_ELEMENTS * sizeof(ARENA_TYPE), flags);
+    if (backing == MAP_FAILED) {
+        arena_tracking_dealloc(&tracking);
+        return (ARENA) { .tracking = { .free = NULL }, .file = { .fd = -1 } };
+    }
+
+    return (ARENA) {
+        .tracking = tracking,
+        .backing = backing,
+        .committed = 0,
+        .file = { .fd = -1 },
+    };
+}
+
 ARENA NAME(arena_create)() {
+    return NAME(arena_create_flags)(0);
+}
+
+// Arena with tracking and backing in one VmFile, so arena_save and
+// arena_restore can roll it back. file.fd is -1 on failure.
+ARENA NAME(arena_create_snapshot)(void) {
+    Usize tracking_size = arena_tracking_size();
+    VmFile file = vm_file_reserve(tracking_size + ARENA_MAX_ELEMENTS * sizeof(ARENA_TYPE));
+    if (file.fd < 0) { return (ARENA) { .file = file }; }
+
+    ArenaTracking tracking = arena_tracking_create_at(file.ptr);
+    if (tracking.free == NULL) {
+        vm_file_dealloc(&file);
+        return (ARENA) { .file = { .fd = -1 } };
+    }
+
     return (ARENA) {
-        .tracking = arena_tracking_create(),
-        .backing = vm_alloc(ARENA_MAX_ELEMENTS * sizeof(ARENA_TYPE)),
+        .tracking = tracking,
+        .backing = (ARENA_TYPE*)(void*)(file.ptr + tracking_size),
+        .committed = 0,
+        .file = file,
+        .saved_element_num = 0,
     };
 }
 
+// Calls fn on the committed parts of the file, committed never shrinks so
+// these cover everything written since the last save.
+static int NAME(arena_file_ranges)(ARENA* ar, int (*fn)(VmFile*, Usize, Usize)) {
+    ArenaTracking* tr = &ar->tracking;
+    U8* base = ar->file.ptr;
+    int ret = 0;
+    ret |= fn(&ar->file, (Usize)((U8*)tr->free - base), tr->committed / 8);
+    ret |= fn(&ar->file, (Usize)((U8*)tr->free_summary - base), (Usize)((U8*)tr->generations - (U8*)tr->free_summary));
+    ret |= fn(&ar->file, (Usize)((U8*)tr->generations - base), (Usize)tr->committed * sizeof(ArenaGen));
+    ret |= fn(&ar->file, (Usize)((U8*)ar->backing - base), (Usize)ar->committed * sizeof(ARENA_TYPE));
+    return ret;
+}
+
+// Saves the current state, copying only pages written since the last save.
+// returns 0 on success, 1 on failure
+int NAME(arena_save)(ARENA* ar) {
+    assert(ar->file.fd >= 0);
+    if (NAME(arena_file_ranges)(ar, vm_file_save_range) != 0) { return 1; }
+    ar->saved_element_num = ar->tracking.element_num;
+    return 0;
+}
+
+// Goes back to the state of the last arena_save, or to empty before any.
+// Pointers into the arena stay valid.
+// returns 0 on success, 1 on failure
+int NAME(arena_restore)(ARENA* ar) {
+    assert(ar->file.fd >= 0);
+    if (NAME(arena_file_ranges)(ar, vm_file_restore_range) != 0) { return 1; }
+    ar->tracking.element_num = ar->saved_element_num;
+    return 0;
+}
+
+// the key's idx is ARENA_INVALID_IDX if memory for a new slot can't be committed
 ArenaKey NAME(arena_insert)(ARENA* ar, ARENA_TYPE e) {
     ArenaKey k = arena_tracking_insert(&ar->tracking);
+    if (k.idx == ARENA_INVALID_IDX) { return k; }
+
+    if (k.idx >= ar->committed) {
+        U32 target = ar->tracking.committed;
+        if (vm_commit_grow(ar->backing, (Usize)ar->committed * sizeof(ARENA_TYPE),
+                (Usize)target * sizeof(ARENA_TYPE), ar->tracking.flags) != 0) {
+            arena_tracking_remove(&ar->tracking, k);
+            return (ArenaKey) { .idx = ARENA_INVALID_IDX, .gen = 0 };
+        }
+        ar->committed = target;
+    }
     ar->backing[k.idx] = e;
     return k;
 }
@@ -37,8 +141,60 @@ ARENA_TYPE* NAME(arena_lookup)(ARENA* ar, ArenaKey k) {
     return &ar->backing[k.idx];
 }
 
+// calls fn on every live element, in index order
+void NAME(arena_visit)(ARENA* ar, void (*fn)(ARENA_TYPE* e, void* ctx), void* ctx) {
+    U32 words = ((U32)ar->tracking.element_num + 63) / 64;
+    for (U32 w = 0; w < words; ++w) {
+        for (U64 live = arena_live_word(&ar->tracking, w); live != 0; live &= live - 1) {
+            fn(&ar->backing[w * 64 + lowest_bit_idx(live)], ctx);
+        }
+    }
+}
+
+// Thread safe versions, see arena_tracking_insert_atomic.
+// Backing memory is never released while the arena lives, so pointers stay
+// readable after a concurrent remove, but the slot may already hold a new element.
+
+ArenaKey NAME(arena_insert_atomic)(ARENA* ar, ARENA_TYPE e) {
+    ArenaKey k = arena_tracking_insert_atomic(&ar->tracking);
+    if (k.idx == ARENA_INVALID_IDX) { return k; }
+
+    U32 committed = __atomic_load_n(&ar->committed, __ATOMIC_ACQUIRE);
+    if (k.idx >= committed) {
+        // tracking has committed past k.idx, commit backing to match
+        U32 target = __atomic_load_n(&ar->tracking.committed, __ATOMIC_ACQUIRE);
+        if (vm_commit_grow(ar->backing, (Usize)committed * sizeof(ARENA_TYPE),
+                (Usize)target * sizeof(ARENA_TYPE), ar->tracking.flags) != 0) {
+            arena_tracking_remove_atomic(&ar->tracking, k);
+            return (ArenaKey) { .idx = ARENA_INVALID_IDX, .gen = 0 };
+        }
+        while (committed < target && !__atomic_compare_exchange_n(&ar->committed, &committed, target,
+                false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {}
+    }
+    ar->backing[k.idx] = e;
+    return k;
+}
+
+// returns false if k was already removed
+bool NAME(arena_remove_atomic)(ARENA* ar, ArenaKey k) {
+    return arena_tracking_remove_atomic(&ar->tracking, k);
+}
+
+// Copies the element of k to out.
+// returns false if k was removed, before or during the copy
+bool NAME(arena_read_atomic)(ARENA* ar, ArenaKey k, ARENA_TYPE* out) {
+    if (!arena_tracking_key_valid_atomic(&ar->tracking, k)) return false;
+    *out = ar->backing[k.idx];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return arena_tracking_key_valid_atomic(&ar->tracking, k);
+}
+
 void NAME(arena_dealloc)(ARENA* ar) {
-    vm_dealloc(ar->backing, ARENA_MAX_ELEMENTS * sizeof(ARENA_TYPE));
+    if (ar->file.fd >= 0) {
+        vm_file_dealloc(&ar->file);
+        return;
+    }
+    vm_dealloc(ar->backing, vm_flags_size(ARENA_MAX_ELEMENTS * sizeof(ARENA_TYPE), ar->tracking.flags));
     arena_tracking_dealloc(&ar->tracking);
 }
 
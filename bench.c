@@ -0,0 +1,851 @@
+#include "tools.h"
+#include <pthread.h>
+
+#define HASH_MAP_TYPE U32
+#include "map.h"
+
+// same value type as Map_U32, so the comparison only differs in the growth mode
+typedef U32 IncU32;
+#define HASH_MAP_TYPE IncU32
+#define HASH_MAP_INCREMENTAL
+#include "map.h"
+
+typedef U32 InlineU32;
+#define HASH_MAP_TYPE InlineU32
+#define HASH_MAP_INLINE
+#include "map.h"
+
+#define CONCURRENT_MAP_TYPE U32
+#include "concurrent_map.h"
+
+#define ARENA_TYPE U64
+#include "arena.h"
+
+#define SLOT_MAP_TYPE U64
+#include "slot_map.h"
+
+// big enough that copying a full arena hurts
+typedef struct {
+    U64 v[32];
+} BenchEntity;
+
+#define ARENA_TYPE BenchEntity
+#include "arena.h"
+
+// a typical tree or list node
+typedef struct {
+    U64 key;
+    void* children[4];
+    U64 value;
+} BenchNode;
+
+#define POOL_TYPE BenchNode
+#include "pool.h"
+
+static volatile U64 bench_sink;
+
+#define BENCH_LOADS 4
+static const F64 bench_loads[BENCH_LOADS] = { 0.5, 0.7, 0.8, 0.9 };
+
+// keys are hashed so consecutive lookups land on random slots
+static HashKey bench_key(U64 i) {
+    HashKey k = HASH(i);
+    return k > 1 ? k : 2;
+}
+
+// throughput of hash_bytes vs hash_bytes_64 over keys of each length
+int bench_hash(void) {
+    printf("hash_bytes vs hash_bytes_64 (GB/s)\n");
+    printf("  len   murmur3    64 bit\n");
+
+    static const U64 lens[] = { 4, 8, 16, 32, 64, 256, 4096 };
+    U64 total = 1u << 28;
+    U8* buf = malloc(4096 + 64);
+    for (U64 i = 0; i < 4096 + 64; ++i) { buf[i] = (U8)(i * 131); }
+
+    for (U64 l = 0; l < sizeof(lens) / sizeof(lens[0]); ++l) {
+        U64 len = lens[l];
+        U64 n = total / len;
+        U64 sum = 0;
+
+        // offset moves so the compiler can't hoist the hash out of the loop
+        Timer t = timer_start();
+        for (U64 i = 0; i < n; ++i) { sum += hash_bytes(buf + (i & 63), len); }
+        F64 murmur = timer_lap_ns(&t);
+        for (U64 i = 0; i < n; ++i) { sum += hash_bytes_64(buf + (i & 63), len); }
+        F64 wide = timer_lap_ns(&t);
+
+        bench_sink = sum;
+        printf("%5lu  %8.2f  %8.2f\n", len, (F64)total / murmur, (F64)total / wide);
+    }
+
+    free(buf);
+    return 0;
+}
+
+// one HASH per key vs hash_u32_batch and hash_u64_batch
+int bench_hash_batch(void) {
+    U64 n = 1u << 16;
+    U64 rounds = 1u << 10;
+    printf("HASH loop vs batch, %lu keys (ns/key)\n", n);
+
+    U32* keys_32 = malloc(n * sizeof(U32));
+    U64* keys_64 = malloc(n * sizeof(U64));
+    HashKey* out = malloc(n * sizeof(HashKey));
+    for (U64 i = 0; i < n; ++i) {
+        keys_32[i] = (U32)(i * 2654435761u);
+        keys_64[i] = i * 0x9e3779b97f4a7c15;
+    }
+
+    Timer t = timer_start();
+    for (U64 r = 0; r < rounds; ++r) {
+        for (U64 i = 0; i < n; ++i) { out[i] = HASH(keys_32[i]); }
+        bench_sink = out[r];
+    }
+    F64 loop_32 = timer_lap_ns(&t) / (F64)(n * rounds);
+    for (U64 r = 0; r < rounds; ++r) {
+        hash_u32_batch(keys_32, out, n);
+        bench_sink = out[r];
+    }
+    F64 batch_32 = timer_lap_ns(&t) / (F64)(n * rounds);
+    for (U64 r = 0; r < rounds; ++r) {
+        for (U64 i = 0; i < n; ++i) { out[i] = HASH(keys_64[i]); }
+        bench_sink = out[r];
+    }
+    F64 loop_64 = timer_lap_ns(&t) / (F64)(n * rounds);
+    for (U64 r = 0; r < rounds; ++r) {
+        hash_u64_batch(keys_64, out, n);
+        bench_sink = out[r];
+    }
+    F64 batch_64 = timer_lap_ns(&t) / (F64)(n * rounds);
+
+    printf("U32  loop %5.2f  batch %5.2f\n", loop_32, batch_32);
+    printf("U64  loop %5.2f  batch %5.2f\n", loop_64, batch_64);
+
+    free(keys_32);
+    free(keys_64);
+    free(out);
+    return 0;
+}
+
+int bench_set(U32 size) {
+    printf("set vs group set, %u slots\n", size);
+    printf("load   set insert  set hit  set miss  group insert  group hit  group miss  (ns/op)\n");
+
+    for (U32 l = 0; l < BENCH_LOADS; ++l) {
+        U64 n = (U64)(bench_loads[l] * size);
+        U64 found = 0;
+
+        // max load of 1 keeps the table at exactly size slots
+        Set set = set_create_load(size, 1.0f);
+        Timer t = timer_start();
+        for (U64 i = 0; i < n; ++i) { set_insert(&set, bench_key(i)); }
+        F64 set_insert_ns = timer_lap_ns(&t) / (F64)n;
+        for (U64 i = 0; i < n; ++i) { found += set_lookup(&set, bench_key(i)) & 1; }
+        F64 set_hit_ns = timer_lap_ns(&t) / (F64)n;
+        for (U64 i = n; i < 2*n; ++i) { found += set_lookup(&set, bench_key(i)) & 1; }
+        F64 set_miss_ns = timer_lap_ns(&t) / (F64)n;
+        set_dealloc(&set);
+
+        GroupSet group = group_set_create_load(size, 1.0f);
+        t = timer_start();
+        for (U64 i = 0; i < n; ++i) { group_set_insert(&group, bench_key(i)); }
+        F64 group_insert_ns = timer_lap_ns(&t) / (F64)n;
+        for (U64 i = 0; i < n; ++i) { found += group_set_lookup(&group, bench_key(i)) & 1; }
+        F64 group_hit_ns = timer_lap_ns(&t) / (F64)n;
+        for (U64 i = n; i < 2*n; ++i) { found += group_set_lookup(&group, bench_key(i)) & 1; }
+        F64 group_miss_ns = timer_lap_ns(&t) / (F64)n;
+        group_set_dealloc(&group);
+
+        bench_sink = found;
+        printf("%.2f   %10.1f  %7.1f  %8.1f  %12.1f  %9.1f  %10.1f\n",
+            bench_loads[l], set_insert_ns, set_hit_ns, set_miss_ns,
+            group_insert_ns, group_hit_ns, group_miss_ns);
+    }
+
+    return 0;
+}
+
+static int bench_cmp_f64(const void* a, const void* b) {
+    F64 x = *(const F64*)a;
+    F64 y = *(const F64*)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_print_latency(const char* name, F64* ns, U64 n) {
+    F64 total = 0.0;
+    for (U64 i = 0; i < n; ++i) { total += ns[i]; }
+
+    qsort(ns, n, sizeof(F64), bench_cmp_f64);
+    printf("%-12s p50 %6.0f  p99 %6.0f  p99.9 %8.0f  max %11.0f  total %7.1fms\n", name,
+        ns[n/2], ns[n*99/100], ns[n*999/1000], ns[n-1], total / 1'000'000.0);
+}
+
+// per insert latency (ns) while growing from an empty map
+int bench_map_grow(U64 n) {
+    printf("map insert latency while growing to %lu keys (ns)\n", n);
+    F64* ns = malloc(n * sizeof(F64));
+
+    Map_U32 map = map_create_U32(16);
+    for (U64 i = 0; i < n; ++i) {
+        Timer t = timer_start();
+        map_insert_U32(&map, bench_key(i), (U32)i);
+        ns[i] = timer_elapsed_ns(&t);
+    }
+    map_dealloc_U32(&map);
+    bench_print_latency("rehash", ns, n);
+
+    Map_IncU32 inc = map_create_IncU32(16);
+    for (U64 i = 0; i < n; ++i) {
+        Timer t = timer_start();
+        map_insert_IncU32(&inc, bench_key(i), (U32)i);
+        ns[i] = timer_elapsed_ns(&t);
+    }
+    map_dealloc_IncU32(&inc);
+    bench_print_latency("incremental", ns, n);
+
+    free(ns);
+    return 0;
+}
+
+// loop of single lookups vs batched lookups, table at 0.8 load
+int bench_lookup_batch(U32 size) {
+    U32 n = (U32)(0.8 * size);
+    printf("lookup loop vs batch, %u slots (ns/lookup)\n", size);
+
+    Set set = set_create_load(size, 1.0f);
+    GroupSet group = group_set_create_load(size, 1.0f);
+    Map_U32 map = map_create_U32(n);
+    for (U64 i = 0; i < n; ++i) {
+        set_insert(&set, bench_key(i));
+        group_set_insert(&group, bench_key(i));
+        map_insert_U32(&map, bench_key(i), (U32)i);
+    }
+
+    // half hits, hashed up front so only the lookups are timed
+    HashKey* keys = malloc(n * sizeof(HashKey));
+    U64* found = malloc(n * sizeof(U64));
+    U32** objects = malloc(n * sizeof(U32*));
+    for (U64 i = 0; i < n; ++i) { keys[i] = bench_key(i * 2); }
+
+    U64 sum = 0;
+    Timer t = timer_start();
+    for (U32 i = 0; i < n; ++i) { sum += set_lookup(&set, keys[i]) & 1; }
+    F64 set_loop = timer_lap_ns(&t) / n;
+    set_lookup_batch(&set, keys, found, n);
+    F64 set_batch = timer_lap_ns(&t) / n;
+    for (U32 i = 0; i < n; ++i) { sum += group_set_lookup(&group, keys[i]) & 1; }
+    F64 group_loop = timer_lap_ns(&t) / n;
+    group_set_lookup_batch(&group, keys, found, n);
+    F64 group_batch = timer_lap_ns(&t) / n;
+    for (U32 i = 0; i < n; ++i) { sum += map_lookup_U32(&map, keys[i]) != NULL; }
+    F64 map_loop = timer_lap_ns(&t) / n;
+    map_lookup_batch_U32(&map, keys, objects, n);
+    F64 map_batch = timer_lap_ns(&t) / n;
+
+    bench_sink = sum + found[n/2] + (U64)(Usize)objects[n/2];
+    printf("set    loop %6.1f  batch %6.1f\n", set_loop, set_batch);
+    printf("group  loop %6.1f  batch %6.1f\n", group_loop, group_batch);
+    printf("map    loop %6.1f  batch %6.1f\n", map_loop, map_batch);
+
+    free(keys);
+    free(found);
+    free(objects);
+    set_dealloc(&set);
+    group_set_dealloc(&group);
+    map_dealloc_U32(&map);
+    return 0;
+}
+
+// split keys/objects arrays vs inline buckets, n keys at default load
+int bench_map_inline(U32 n) {
+    printf("map split vs inline buckets, %u keys (ns/lookup)\n", n);
+
+    Map_U32 map = map_create_U32(n);
+    Map_InlineU32 inline_map = map_create_InlineU32(n);
+    for (U64 i = 0; i < n; ++i) {
+        map_insert_U32(&map, bench_key(i), (U32)i);
+        map_insert_InlineU32(&inline_map, bench_key(i), (U32)i);
+    }
+
+    U64 sum = 0;
+    Timer t = timer_start();
+    for (U64 i = 0; i < n; ++i) { sum += *map_lookup_U32(&map, bench_key(i)); }
+    F64 split_hit = timer_lap_ns(&t) / n;
+    for (U64 i = n; i < 2*(U64)n; ++i) { sum += map_lookup_U32(&map, bench_key(i)) != NULL; }
+    F64 split_miss = timer_lap_ns(&t) / n;
+    for (U64 i = 0; i < n; ++i) { sum += *map_lookup_InlineU32(&inline_map, bench_key(i)); }
+    F64 inline_hit = timer_lap_ns(&t) / n;
+    for (U64 i = n; i < 2*(U64)n; ++i) { sum += map_lookup_InlineU32(&inline_map, bench_key(i)) != NULL; }
+    F64 inline_miss = timer_lap_ns(&t) / n;
+
+    bench_sink = sum;
+    printf("split   hit %6.1f  miss %6.1f\n", split_hit, split_miss);
+    printf("inline  hit %6.1f  miss %6.1f\n", inline_hit, inline_miss);
+
+    map_dealloc_U32(&map);
+    map_dealloc_InlineU32(&inline_map);
+    return 0;
+}
+
+// building a map with inserts vs opening a saved one
+int bench_map_snapshot(U32 n) {
+    printf("map with %u keys, build vs open snapshot (ms)\n", n);
+    const char* path = "/tmp/tools_bench_map_snapshot";
+
+    Timer t = timer_start();
+    Map_U32 map = map_create_U32(16);
+    for (U64 i = 0; i < n; ++i) {
+        map_insert_U32(&map, bench_key(i), (U32)i);
+    }
+    F64 build = timer_lap_ms(&t);
+
+    if (map_save_U32(&map, path) != 0) { return 1; }
+    F64 save = timer_lap_ms(&t);
+
+    Map_U32 opened;
+    if (map_open_mmap_U32(&opened, path) != 0) { return 1; }
+    F64 open_ms = timer_lap_ms(&t);
+
+    // first lookups fault pages in from the page cache
+    U64 sum = 0;
+    for (U64 i = 0; i < n; i += 64) { sum += *map_lookup_U32(&opened, bench_key(i)); }
+    F64 touch = timer_lap_ms(&t);
+    bench_sink = sum;
+
+    printf("build %.1f  save %.1f  open %.3f  first n/64 lookups %.1f\n", build, save, open_ms, touch);
+
+    map_close_mmap_U32(&opened);
+    map_dealloc_U32(&map);
+    unlink(path);
+    return 0;
+}
+
+#define BENCH_MAX_THREADS 32
+#define BENCH_CONCURRENT_KEYS (1u << 20)
+#define BENCH_CONCURRENT_OPS (1u << 21)
+
+typedef struct {
+    ConcurrentMap_U32* concurrent;
+    Map_U32* locked;
+    pthread_mutex_t* lock;
+    U32 thread;
+    U64 found;
+} BenchConcurrentArgs;
+
+// 95% lookups of existing keys, 5% inserts of new keys
+static void* bench_concurrent_thread(void* ptr) {
+    BenchConcurrentArgs* args = ptr;
+    U64 found = 0;
+    U64 insert_key = BENCH_CONCURRENT_KEYS + (U64)args->thread * BENCH_CONCURRENT_OPS;
+
+    for (U64 i = 0; i < BENCH_CONCURRENT_OPS; ++i) {
+        U64 r = i * 0x9E3779B1 + args->thread;
+        if (r % 20 == 0) {
+            HashKey key = bench_key(insert_key++);
+            if (args->concurrent != NULL) {
+                concurrent_map_insert_U32(args->concurrent, key, (U32)i);
+            } else {
+                pthread_mutex_lock(args->lock);
+                map_insert_U32(args->locked, key, (U32)i);
+                pthread_mutex_unlock(args->lock);
+            }
+        } else {
+            HashKey key = bench_key(r % BENCH_CONCURRENT_KEYS);
+            if (args->concurrent != NULL) {
+                found += concurrent_map_lookup_U32(args->concurrent, key) != NULL;
+            } else {
+                pthread_mutex_lock(args->lock);
+                found += map_lookup_U32(args->locked, key) != NULL;
+                pthread_mutex_unlock(args->lock);
+            }
+        }
+    }
+
+    args->found = found;
+    return NULL;
+}
+
+static F64 bench_concurrent_run(U32 thread_num, bool concurrent) {
+    ConcurrentMap_U32 map = concurrent_map_create_U32(BENCH_CONCURRENT_KEYS);
+    Map_U32 locked = map_create_U32(BENCH_CONCURRENT_KEYS);
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    for (U64 i = 0; i < BENCH_CONCURRENT_KEYS; ++i) {
+        if (concurrent) {
+            concurrent_map_insert_U32(&map, bench_key(i), (U32)i);
+        } else {
+            map_insert_U32(&locked, bench_key(i), (U32)i);
+        }
+    }
+
+    pthread_t threads[BENCH_MAX_THREADS];
+    BenchConcurrentArgs args[BENCH_MAX_THREADS];
+
+    Timer t = timer_start();
+    for (U32 i = 0; i < thread_num; ++i) {
+        args[i] = (BenchConcurrentArgs) {
+            .concurrent = concurrent ? &map : NULL,
+            .locked = &locked,
+            .lock = &lock,
+            .thread = i,
+            .found = 0,
+        };
+        pthread_create(&threads[i], NULL, bench_concurrent_thread, &args[i]);
+    }
+    for (U32 i = 0; i < thread_num; ++i) {
+        pthread_join(threads[i], NULL);
+        bench_sink += args[i].found;
+    }
+    F64 s = timer_elapsed_s(&t);
+
+    concurrent_map_dealloc_U32(&map);
+    map_dealloc_U32(&locked);
+
+    // million operations per second
+    return (F64)thread_num * BENCH_CONCURRENT_OPS / s / 1'000'000.0;
+}
+
+// read heavy throughput of ConcurrentMap vs a Map behind a mutex
+int bench_concurrent(void) {
+    U32 cores = (U32)sysconf(_SC_NPROCESSORS_ONLN);
+    printf("concurrent map vs locked map, 95%% lookups, %u cores (Mops/s)\n", cores);
+    printf("threads  concurrent  locked\n");
+
+    for (U32 thread_num = 1; thread_num <= BENCH_MAX_THREADS; thread_num *= 2) {
+        F64 concurrent = bench_concurrent_run(thread_num, true);
+        F64 locked = bench_concurrent_run(thread_num, false);
+        printf("%7u  %10.1f  %6.1f\n", thread_num, concurrent, locked);
+        if (thread_num >= cores && thread_num >= 4) { break; }
+    }
+
+    return 0;
+}
+
+// insert into an arena whose only free slot is near the end
+int bench_arena_insert(void) {
+    ArenaTracking ar = arena_tracking_create();
+    U64 max = ARENA_MAX_ELEMENTS - 1;
+    for (U64 i = 0; i < max; ++i) { arena_tracking_insert(&ar); }
+
+    U64 n = 1u << 20;
+    ArenaKey key = { .idx = (ArenaIdx)(max - 1), .gen = ar.generations[max - 1] };
+    Timer t = timer_start();
+    for (U64 i = 0; i < n; ++i) {
+        arena_tracking_remove(&ar, key);
+        key = arena_tracking_insert(&ar);
+    }
+    F64 ns = timer_lap_ns(&t) / (F64)n;
+
+    printf("arena remove + insert, %lu elements, free slot at the end: %.1fns\n", max, ns);
+
+    arena_tracking_dealloc(&ar);
+    return 0;
+}
+
+static void bench_arena_add(U64* e, void* ctx) {
+    *(U64*)ctx += *e;
+}
+
+// sum over an arena with every 10th element removed
+int bench_arena_iter(void) {
+    Arena_U64 ar = arena_create_U64();
+    U64 n = ARENA_MAX_ELEMENTS - 1;
+    for (U64 i = 0; i < n; ++i) { arena_insert_U64(&ar, i); }
+    for (U64 i = 0; i < n; i += 10) {
+        arena_remove_U64(&ar, (ArenaKey) { .idx = (ArenaIdx)i, .gen = ar.tracking.generations[i] });
+    }
+
+    U64 rounds = 1000;
+    U64 sum = 0;
+    Timer t = timer_start();
+    for (U64 r = 0; r < rounds; ++r) {
+        ArenaIter iter = arena_iter(&ar.tracking);
+        while (true) {
+            ArenaKey k = arena_iter_next(&iter);
+            if (k.idx == ARENA_INVALID_IDX) { break; }
+            sum += ar.backing[k.idx];
+        }
+    }
+    F64 iter_ns = timer_lap_ns(&t) / (F64)(n * rounds);
+    for (U64 r = 0; r < rounds; ++r) {
+        ARENA_FOREACH(&ar, e) { sum += *e; }
+    }
+    F64 foreach_ns = timer_lap_ns(&t) / (F64)(n * rounds);
+    for (U64 r = 0; r < rounds; ++r) {
+        arena_visit_U64(&ar, bench_arena_add, &sum);
+    }
+    F64 visit_ns = timer_lap_ns(&t) / (F64)(n * rounds);
+    for (U64 r = 0; r < rounds; ++r) {
+        for (U64 i = 0; i < n; ++i) { sum += ar.backing[i]; }
+    }
+    F64 array_ns = timer_lap_ns(&t) / (F64)(n * rounds);
+
+    // same elements packed densely
+    SlotMap_U64 slot_map = slot_map_create_U64();
+    for (U64 i = 0; i < n; ++i) { slot_map_insert_U64(&slot_map, i); }
+    for (U64 i = 0; i < n; i += 10) {
+        slot_map_remove_U64(&slot_map, (ArenaKey) { .idx = (ArenaIdx)i, .gen = slot_map.tracking.generations[i] });
+    }
+    timer_lap_ns(&t);
+    U64* values = slot_map.values;
+    U64 len = slot_map.len;
+    for (U64 r = 0; r < rounds; ++r) {
+        for (U64 i = 0; i < len; ++i) { sum += values[i]; }
+    }
+    F64 slot_map_ns = timer_lap_ns(&t) / (F64)(len * rounds);
+
+    bench_sink = sum;
+    printf("arena iteration, %lu elements 90%% live (ns/element)\n", n);
+    printf("arena_iter_next %.2f  ARENA_FOREACH %.2f  arena_visit %.2f  whole array %.2f  slot map %.2f\n",
+        iter_ns, foreach_ns, visit_ns, array_ns, slot_map_ns);
+
+    arena_dealloc_U64(&ar);
+    slot_map_dealloc_U64(&slot_map);
+    return 0;
+}
+
+// save/restore of a full arena with a few dirtied elements vs copying all of it
+int bench_arena_snapshot(void) {
+    Arena_BenchEntity ar = arena_create_snapshot_BenchEntity();
+    U64 n = ARENA_MAX_ELEMENTS - 1;
+    for (U64 i = 0; i < n; ++i) { arena_insert_BenchEntity(&ar, (BenchEntity) { .v = { i } }); }
+    arena_save_BenchEntity(&ar);
+
+    Usize size = n * sizeof(BenchEntity);
+    U8* copy = malloc(size);
+    U64 rounds = 100;
+
+    Timer t = timer_start();
+    for (U64 r = 0; r < rounds; ++r) {
+        for (U64 i = 0; i < n; i += n / 16) { ar.backing[i].v[0] += 1; }
+        arena_save_BenchEntity(&ar);
+    }
+    F64 save_us = timer_lap_us(&t) / (F64)rounds;
+    for (U64 r = 0; r < rounds; ++r) {
+        for (U64 i = 0; i < n; i += n / 16) { ar.backing[i].v[0] += 1; }
+        arena_restore_BenchEntity(&ar);
+    }
+    F64 restore_us = timer_lap_us(&t) / (F64)rounds;
+    for (U64 r = 0; r < rounds; ++r) {
+        memcpy(copy, ar.backing, size);
+        bench_sink = copy[r];
+    }
+    F64 copy_us = timer_lap_us(&t) / (F64)rounds;
+
+    printf("arena snapshot, %lu elements of %lu bytes, 16 dirty pages (us)\n", n, sizeof(BenchEntity));
+    printf("save %.1f  restore %.1f  memcpy of backing %.1f\n", save_us, restore_us, copy_us);
+
+    free(copy);
+    arena_dealloc_BenchEntity(&ar);
+    return 0;
+}
+
+int bench_vm_flags(void) {
+    U64 n = ARENA_MAX_ELEMENTS - 1;
+    U64 reads = 1u << 24;
+    VmFlags all[] = { 0, VM_POPULATE, VM_HUGE_THP, VM_HUGE_THP | VM_POPULATE };
+    const char* names[] = { "default", "populate", "thp", "thp populate" };
+
+    printf("arena of %lu elements of %lu bytes, insert all then random reads (ns)\n", n, sizeof(BenchEntity));
+    for (U64 f = 0; f < sizeof(all) / sizeof(all[0]); ++f) {
+        Arena_BenchEntity ar = arena_create_flags_BenchEntity(all[f]);
+        ArenaKey* keys = malloc(n * sizeof(ArenaKey));
+        Prng p = prng_create(1);
+
+        Timer t = timer_start();
+        for (U64 i = 0; i < n; ++i) { keys[i] = arena_insert_BenchEntity(&ar, (BenchEntity) { .v = { i } }); }
+        F64 insert_ns = timer_lap_ns(&t) / (F64)n;
+
+        U64 sum = 0;
+        for (U64 i = 0; i < reads; ++i) {
+            sum += arena_lookup_BenchEntity(&ar, keys[prng_next(&p) % n])->v[0];
+        }
+        F64 read_ns = timer_lap_ns(&t) / (F64)reads;
+        bench_sink = (U8)sum;
+
+        printf("%-14s insert %.2f  read %.2f\n", names[f], insert_ns, read_ns);
+        free(keys);
+        arena_dealloc_BenchEntity(&ar);
+    }
+    return 0;
+}
+
+// rounds of allocations up to 1 KB, cleared between rounds
+int bench_bump(void) {
+    U64 rounds = 64;
+    U64 n = 1u << 16;
+    Usize* sizes = malloc(n * sizeof(Usize));
+    Prng p = prng_create(2);
+    for (U64 i = 0; i < n; ++i) { sizes[i] = (prng_next(&p) & 1023) + 1; }
+
+    BumpList list = bump_list_create();
+    BumpRange range = bump_range_create();
+    U64 sum = 0;
+
+    Timer t = timer_start();
+    for (U64 r = 0; r < rounds; ++r) {
+        for (U64 i = 0; i < n; ++i) {
+            U8* ptr = bump_list_alloc(&list, sizes[i], 8);
+            ptr[0] = (U8)i;
+            sum += (Usize)ptr;
+        }
+        bump_list_clear(&list);
+    }
+    F64 list_ns = timer_lap_ns(&t) / (F64)(rounds * n);
+
+    for (U64 r = 0; r < rounds; ++r) {
+        for (U64 i = 0; i < n; ++i) {
+            U8* ptr = bump_range_alloc(&range, sizes[i], 8);
+            ptr[0] = (U8)i;
+            sum += (Usize)ptr;
+        }
+        bump_range_clear(&range);
+    }
+    F64 range_ns = timer_lap_ns(&t) / (F64)(rounds * n);
+
+    for (U64 r = 0; r < rounds; ++r) {
+        U8* big = bump_range_alloc(&range, (Usize)64 << 20, 64);
+        big[r] = 1;
+        sum += (Usize)big;
+        bump_range_clear(&range);
+    }
+    F64 big_ns = timer_lap_ns(&t) / (F64)rounds;
+    bench_sink = sum;
+
+    printf("bump alloc up to 1 KB (ns): list %.2f  range %.2f, range 64 MB %.1f\n", list_ns, range_ns, big_ns);
+
+    free(sizes);
+    bump_list_dealloc(&list);
+    bump_range_dealloc(&range);
+    return 0;
+}
+
+// requests of 4 nested stages, each with 256 scratch allocations freed when it ends
+int bench_bump_mark(void) {
+    U64 requests = 2048;
+    U64 stages = 4;
+    U64 n = 256;
+    Usize sizes[256];
+    Prng p = prng_create(3);
+    for (U64 i = 0; i < n; ++i) { sizes[i] = (prng_next(&p) & 255) + 1; }
+
+    U8** ptrs = malloc(stages * n * sizeof(U8*));
+    U64 sum = 0;
+
+    Timer t = timer_start();
+    for (U64 r = 0; r < requests; ++r) {
+        for (U64 s = 0; s < stages; ++s) {
+            for (U64 i = 0; i < n; ++i) {
+                U8* ptr = malloc(sizes[i]);
+                ptr[0] = (U8)i;
+                ptrs[s * n + i] = ptr;
+            }
+        }
+        for (U64 s = stages; s-- > 0;) {
+            for (U64 i = 0; i < n; ++i) {
+                sum += ptrs[s * n + i][0];
+                free(ptrs[s * n + i]);
+            }
+        }
+    }
+    F64 malloc_ns = timer_lap_ns(&t) / (F64)(requests * stages * n);
+
+    BumpList b = bump_list_create();
+    for (U64 r = 0; r < requests; ++r) {
+        BumpMark marks[4];
+        for (U64 s = 0; s < stages; ++s) {
+            marks[s] = bump_list_mark(&b);
+            for (U64 i = 0; i < n; ++i) {
+                U8* ptr = bump_list_alloc(&b, sizes[i], 8);
+                ptr[0] = (U8)i;
+                ptrs[s * n + i] = ptr;
+            }
+        }
+        for (U64 s = stages; s-- > 0;) {
+            for (U64 i = 0; i < n; ++i) { sum += ptrs[s * n + i][0]; }
+            bump_list_restore(&b, marks[s]);
+        }
+    }
+    F64 mark_ns = timer_lap_ns(&t) / (F64)(requests * stages * n);
+    bench_sink = sum;
+
+    printf("nested scratch, alloc and free (ns): malloc %.2f  bump mark %.2f\n", malloc_ns, mark_ns);
+
+    free(ptrs);
+    bump_list_dealloc(&b);
+    return 0;
+}
+
+// frames of 1 MB of allocations up to 1 KB, cleared at the end of each frame
+int bench_bump_page_cache(void) {
+    U64 frames = 256;
+    U64 n = 2048;
+    Usize limits[2] = { 0, BUMP_PAGE_CACHE_LIMIT };
+    U64 sum = 0;
+
+    printf("bump list frames of %lu allocs, cleared per frame\n", n);
+    for (U32 l = 0; l < 2; ++l) {
+        bump_page_cache_limit(limits[l]);
+        bump_page_counters_reset();
+        BumpList b = bump_list_create();
+        Prng p = prng_create(4);
+
+        Timer t = timer_start();
+        for (U64 f = 0; f < frames; ++f) {
+            for (U64 i = 0; i < n; ++i) {
+                Usize size = (prng_next(&p) & 1023) + 1;
+                U8* ptr = bump_list_alloc(&b, size, 8);
+                ptr[0] = (U8)i;
+                sum += ptr[0];
+            }
+            bump_list_clear(&b);
+        }
+        F64 frame_us = timer_lap_us(&t) / (F64)frames;
+        BumpPageCounters c = bump_page_counters();
+
+        printf("cache limit %-9lu %.1f us per frame, maps %lu unmaps %lu reuses %lu\n",
+               limits[l], frame_us, c.maps, c.unmaps, c.reuses);
+        bump_list_dealloc(&b);
+    }
+    bench_sink = sum;
+    bump_page_cache_trim();
+    return 0;
+}
+
+// calls that each need a temporary buffer of up to 4 KB
+int bench_scratch(void) {
+    U64 calls = 1u << 20;
+    U64 sum = 0;
+    Prng p = prng_create(5);
+
+    Timer t = timer_start();
+    for (U64 i = 0; i < calls; ++i) {
+        Usize size = (prng_next(&p) & 4095) + 1;
+        U8* tmp = malloc(size);
+        tmp[0] = (U8)i;
+        tmp[size - 1] = (U8)i;
+        sum += tmp[0];
+        free(tmp);
+    }
+    F64 malloc_ns = timer_lap_ns(&t) / (F64)calls;
+
+    for (U64 i = 0; i < calls; ++i) {
+        Usize size = (prng_next(&p) & 4095) + 1;
+        Scratch s = scratch_get(NULL, 0);
+        U8* tmp = bump_list_alloc(s.bump, size, 8);
+        tmp[0] = (U8)i;
+        tmp[size - 1] = (U8)i;
+        sum += tmp[0];
+        scratch_release(s);
+    }
+    F64 scratch_ns = timer_lap_ns(&t) / (F64)calls;
+    bench_sink = sum;
+
+    printf("temporary buffer per call (ns): malloc %.2f  scratch %.2f\n", malloc_ns, scratch_ns);
+    scratch_dealloc();
+    return 0;
+}
+
+#define BENCH_POOL_BURST 4096
+
+static BenchNode* bench_pool_alloc(U32 mode, Pool_BenchNode* pool, PoolCache* cache) {
+    if (mode == 0) { return malloc(sizeof(BenchNode)); }
+    if (mode == 1) { return pool_alloc_BenchNode(pool); }
+    return pool_cache_alloc_BenchNode(pool, cache);
+}
+
+static void bench_pool_free(U32 mode, Pool_BenchNode* pool, PoolCache* cache, BenchNode* e) {
+    if (mode == 0) {
+        free(e);
+    } else if (mode == 1) {
+        pool_free_BenchNode(pool, e);
+    } else {
+        pool_cache_free_BenchNode(pool, cache, e);
+    }
+}
+
+// Builds n nodes, replaces random ones, allocates and frees bursts on top,
+// then frees everything. Times are per alloc or free.
+int bench_pool(void) {
+    U64 n = 1u << 20;
+    U64 bursts = 256;
+    BenchNode** nodes = malloc(n * sizeof(BenchNode*));
+    BenchNode** burst = malloc(BENCH_POOL_BURST * sizeof(BenchNode*));
+    U32* order = malloc(n * sizeof(U32));
+    Prng p = prng_create(6);
+    for (U64 i = 0; i < n; ++i) { order[i] = prng_next(&p) & (U32)(n - 1); }
+    const char* names[3] = { "malloc", "pool", "pool cache" };
+    U64 sum = 0;
+
+    printf("%lu nodes of %lu bytes (ns)\n", n, sizeof(BenchNode));
+    for (U32 mode = 0; mode < 3; ++mode) {
+        Pool_BenchNode pool = pool_create_BenchNode();
+        PoolCache cache = {0};
+
+        Timer t = timer_start();
+        for (U64 i = 0; i < n; ++i) {
+            nodes[i] = bench_pool_alloc(mode, &pool, &cache);
+            nodes[i]->key = i;
+        }
+        F64 build_ns = timer_lap_ns(&t) / (F64)n;
+
+        for (U64 i = 0; i < n; ++i) {
+            BenchNode** e = &nodes[order[i]];
+            sum += (*e)->key;
+            bench_pool_free(mode, &pool, &cache, *e);
+            *e = bench_pool_alloc(mode, &pool, &cache);
+            (*e)->key = i;
+        }
+        F64 churn_ns = timer_lap_ns(&t) / (F64)(n * 2);
+
+        for (U64 b = 0; b < bursts; ++b) {
+            for (U64 i = 0; i < BENCH_POOL_BURST; ++i) {
+                burst[i] = bench_pool_alloc(mode, &pool, &cache);
+                burst[i]->key = i;
+            }
+            for (U64 i = 0; i < BENCH_POOL_BURST; ++i) {
+                sum += burst[i]->key;
+                bench_pool_free(mode, &pool, &cache, burst[i]);
+            }
+        }
+        F64 burst_ns = timer_lap_ns(&t) / (F64)(bursts * BENCH_POOL_BURST * 2);
+
+        for (U64 i = 0; i < n; ++i) { bench_pool_free(mode, &pool, &cache, nodes[i]); }
+        F64 free_ns = timer_lap_ns(&t) / (F64)n;
+
+        printf("%-10s build %.2f  random replace %.2f  burst %.2f  free all %.2f\n",
+               names[mode], build_ns, churn_ns, burst_ns, free_ns);
+
+        pool_cache_flush_BenchNode(&pool, &cache);
+        pool_dealloc_BenchNode(&pool);
+    }
+    bench_sink = sum;
+
+    free(order);
+    free(burst);
+    free(nodes);
+    return 0;
+}
+
+int main(void) {
+    int ret = 0;
+    ret |= bench_bump();
+    ret |= bench_bump_mark();
+    ret |= bench_bump_page_cache();
+    ret |= bench_scratch();
+    ret |= bench_pool();
+    ret |= bench_hash();
+    ret |= bench_hash_batch();
+    ret |= bench_set(1u << 14);
+    ret |= bench_set(1u << 22);
+    ret |= bench_map_grow(1u << 22);
+    ret |= bench_lookup_batch(1u << 24);
+    ret |= bench_map_inline(1u << 23);
+    ret |= bench_map_snapshot(1u << 22);
+    ret |= bench_concurrent();
+    ret |= bench_arena_insert();
+    ret |= bench_arena_iter();
+    ret |= bench_arena_snapshot();
+    ret |= bench_vm_flags();
+    return ret;
+}
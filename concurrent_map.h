@@ -0,0 +1,56 @@
+#ifndef TOOLS_H
+#error "please include tools.h before including concurrent_map.h"
+#else
+
+#ifndef CONCURRENT_MAP_TYPE
+#error "CONCURRENT_MAP_TYPE must be defined before including concurrent_map.h"
+#else
+
+// Thread safe map on top of ConcurrentSet.
+// Lookups are wait-free. Objects are written once by the insert that adds the key
+// and never modified, so a key is updated by removing and inserting it again.
+
+#define NAME(a) CAT2(a, CONCURRENT_MAP_TYPE)
+
+#define MAP NAME(ConcurrentMap)
+
+typedef struct {
+    ConcurrentSet set;
+} MAP;
+
+MAP NAME(concurrent_map_create)(U32 size) {
+    return (MAP) {
+        .set = concurrent_set_create(size, sizeof(CONCURRENT_MAP_TYPE)),
+    };
+}
+
+// returns false if the key already exists, the existing object is kept
+bool NAME(concurrent_map_insert)(MAP* map, HashKey key, CONCURRENT_MAP_TYPE val) {
+    return concurrent_set_insert(&map->set, key, &val);
+}
+
+// returns NULL if not found
+const CONCURRENT_MAP_TYPE* NAME(concurrent_map_lookup)(MAP* map, HashKey key) {
+    return concurrent_set_lookup(&map->set, key);
+}
+
+// returns false if not found
+bool NAME(concurrent_map_remove)(MAP* map, HashKey key) {
+    return concurrent_set_remove(&map->set, key);
+}
+
+// frees replaced tables, no other thread may use the map during this call
+void NAME(concurrent_map_reclaim)(MAP* map) {
+    concurrent_set_reclaim(&map->set);
+}
+
+void NAME(concurrent_map_dealloc)(MAP* map) {
+    concurrent_set_dealloc(&map->set);
+}
+
+#undef CONCURRENT_MAP_TYPE
+#undef NAME
+#undef MAP
+
+#endif
+#endif
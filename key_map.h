@@ -0,0 +1,224 @@
+#ifndef TOOLS_H
+#error "please include tools.h before including key_map.h"
+#else
+
+#if !defined(KEY_MAP_KEY) || !defined(KEY_MAP_VALUE)
+#error "KEY_MAP_KEY and KEY_MAP_VALUE must be defined before including key_map.h"
+#else
+
+// Hash map that stores the keys themselves, unlike map.h which only keeps their hash.
+// Colliding keys don't alias, and any key value can be used.
+//
+// Each slot caches the key's hash next to the key, so most mismatches are
+// rejected without comparing keys. The cached hash uses the Set convention:
+// 0 is empty, 1 is removed, and real hashes of 0 or 1 are stored as 2 or 3.
+//
+// KEY_MAP_HASH(k) and KEY_MAP_EQUAL(a, b) default to HASH and ==.
+// KEY_MAP_NAME defaults to KEY_MAP_KEY_KEY_MAP_VALUE, eg. KeyMap_String_U32.
+
+#ifndef KEY_MAP_HASH
+#define KEY_MAP_HASH(k) HASH(k)
+#endif
+
+#ifndef KEY_MAP_EQUAL
+#define KEY_MAP_EQUAL(a, b) ((a) == (b))
+#endif
+
+#ifndef KEY_MAP_NAME
+#define KEY_MAP_NAME CAT2(KEY_MAP_KEY, KEY_MAP_VALUE)
+#endif
+
+#define NAME(a) CAT2(a, KEY_MAP_NAME)
+
+#define KEY_MAP NAME(KeyMap)
+#define KEY_MAP_ENTRY NAME(KeyMapEntry)
+
+typedef struct {
+    HashKey hash;
+    KEY_MAP_KEY key;
+} KEY_MAP_ENTRY;
+
+typedef struct {
+    KEY_MAP_ENTRY* entries;
+    KEY_MAP_VALUE* values;
+    U32 mask;
+    U32 count;
+    U32 tombstones;
+    U32 grow_at;
+    F32 max_load;
+} KEY_MAP;
+
+KEY_MAP NAME(key_map_create_load)(U32 size, F32 max_load) {
+    U32 mask = set_mask_for(size, max_load, 0);
+    return (KEY_MAP) {
+        .entries = calloc((U64)mask + 1, sizeof(KEY_MAP_ENTRY)),
+        .values = malloc(((U64)mask + 1) * sizeof(KEY_MAP_VALUE)),
+        .mask = mask,
+        .count = 0,
+        .tombstones = 0,
+        .grow_at = set_load_limit(mask, max_load),
+        .max_load = max_load,
+    };
+}
+
+// allows for at least size elements before growing
+KEY_MAP NAME(key_map_create)(U32 size) {
+    return NAME(key_map_create_load)(size, SET_DEFAULT_MAX_LOAD);
+}
+
+HashKey NAME(key_map_hash)(KEY_MAP_KEY key) {
+    HashKey hash = KEY_MAP_HASH(key);
+    return hash > 1 ? hash : hash + 2;
+}
+
+// returns index of the key, or ~0 if not found
+U32 NAME(key_map_find)(KEY_MAP* map, KEY_MAP_KEY key, HashKey hash) {
+    U32 mask = map->mask;
+    KEY_MAP_ENTRY* entries = map->entries;
+
+    U32 idx = (U32)hash & mask;
+    while (true) {
+        KEY_MAP_ENTRY* e = &entries[idx];
+        if (e->hash == 0) { return ~(U32)0; }
+        if (e->hash == hash && KEY_MAP_EQUAL(e->key, key)) { return idx; }
+
+        // wrap on overflow size
+        idx = (idx + 1) & mask;
+    }
+}
+
+// rebuilds the table with room for at least size elements, dropping tombstones
+void NAME(key_map_rehash)(KEY_MAP* map, U32 size) {
+    assert(size >= map->count);
+
+    KEY_MAP new_map = NAME(key_map_create_load)(size, map->max_load);
+    U32 new_mask = new_map.mask;
+
+    for (U64 i = 0; i <= map->mask; ++i) {
+        KEY_MAP_ENTRY* e = &map->entries[i];
+        if (e->hash <= 1) { continue; }
+
+        // keys are unique and the new table has no tombstones, take the first empty slot
+        U32 idx = (U32)e->hash & new_mask;
+        while (new_map.entries[idx].hash != 0) {
+            idx = (idx + 1) & new_mask;
+        }
+
+        new_map.entries[idx] = *e;
+        new_map.values[idx] = map->values[i];
+    }
+
+    new_map.count = map->count;
+    free(map->entries);
+    free(map->values);
+    *map = new_map;
+}
+
+// grows the map so additional more keys can be inserted without rehashing
+void NAME(key_map_reserve)(KEY_MAP* map, U32 additional) {
+    if ((U64)map->count + map->tombstones + additional <= map->grow_at) { return; }
+
+    U32 size = set_grow_size(map->count, map->grow_at, additional);
+    NAME(key_map_rehash)(map, size);
+}
+
+// replaces the value if the key exists
+void NAME(key_map_insert)(KEY_MAP* map, KEY_MAP_KEY key, KEY_MAP_VALUE val) {
+    HashKey hash = NAME(key_map_hash)(key);
+
+    // only a new key may grow the map
+    if ((U64)map->count + map->tombstones + 1 > map->grow_at && NAME(key_map_find)(map, key, hash) == ~(U32)0) {
+        NAME(key_map_reserve)(map, 1);
+    }
+    U32 mask = map->mask;
+    KEY_MAP_ENTRY* entries = map->entries;
+
+    // first removed slot, which is reused if the key isn't further along
+    U32 removed = ~(U32)0;
+
+    U32 idx = (U32)hash & mask;
+    while (true) {
+        KEY_MAP_ENTRY* e = &entries[idx];
+        if (e->hash == 0) { break; }
+        if (e->hash == hash && KEY_MAP_EQUAL(e->key, key)) {
+            map->values[idx] = val;
+            return;
+        }
+        if (e->hash == 1 && removed == ~(U32)0) { removed = idx; }
+
+        // wrap on overflow size
+        idx = (idx + 1) & mask;
+    }
+
+    if (removed != ~(U32)0) {
+        idx = removed;
+        map->tombstones -= 1;
+    }
+
+    map->count += 1;
+    entries[idx] = (KEY_MAP_ENTRY) { .hash = hash, .key = key };
+    map->values[idx] = val;
+}
+
+// returns NULL if not found
+KEY_MAP_VALUE* NAME(key_map_lookup)(KEY_MAP* map, KEY_MAP_KEY key) {
+    U32 idx = NAME(key_map_find)(map, key, NAME(key_map_hash)(key));
+    if (idx == ~(U32)0) { return NULL; }
+    return &map->values[idx];
+}
+
+// key_map_lookup for n keys, out gets the value pointers (NULL if not found).
+// Hashes a chunk of keys first, then prefetches slots ahead of the probes so cache misses overlap.
+void NAME(key_map_lookup_batch)(KEY_MAP* map, const KEY_MAP_KEY* keys, KEY_MAP_VALUE** out, U32 n) {
+    HashKey hashes[256];
+    U32 mask = map->mask;
+
+    for (U32 start = 0; start < n; start += 256) {
+        U32 len = n - start < 256 ? n - start : 256;
+        for (U32 i = 0; i < len; ++i) {
+            hashes[i] = NAME(key_map_hash)(keys[start + i]);
+        }
+
+        U32 ahead = len < SET_PREFETCH_DISTANCE ? len : SET_PREFETCH_DISTANCE;
+        for (U32 i = 0; i < ahead; ++i) {
+            __builtin_prefetch(&map->entries[hashes[i] & mask]);
+        }
+
+        for (U32 i = 0; i < len; ++i) {
+            if (i + SET_PREFETCH_DISTANCE < len) {
+                __builtin_prefetch(&map->entries[hashes[i + SET_PREFETCH_DISTANCE] & mask]);
+            }
+
+            U32 idx = NAME(key_map_find)(map, keys[start + i], hashes[i]);
+            out[start + i] = idx == ~(U32)0 ? NULL : &map->values[idx];
+        }
+    }
+}
+
+// returns NULL if not found
+KEY_MAP_VALUE* NAME(key_map_remove)(KEY_MAP* map, KEY_MAP_KEY key) {
+    U32 idx = NAME(key_map_find)(map, key, NAME(key_map_hash)(key));
+    if (idx == ~(U32)0) { return NULL; }
+
+    map->entries[idx].hash = 1;
+    map->count -= 1;
+    map->tombstones += 1;
+    return &map->values[idx];
+}
+
+void NAME(key_map_dealloc)(KEY_MAP* map) {
+    free(map->entries);
+    free(map->values);
+}
+
+#undef KEY_MAP_KEY
+#undef KEY_MAP_VALUE
+#undef KEY_MAP_HASH
+#undef KEY_MAP_EQUAL
+#undef KEY_MAP_NAME
+#undef NAME
+#undef KEY_MAP
+#undef KEY_MAP_ENTRY
+
+#endif
+#endif
@@ -10,51 +10,552 @@
 
 #define MAP NAME(Map)
 
+// define HASH_MAP_GROUP to back the map with a GroupSet instead of a Set
+#ifdef HASH_MAP_GROUP
+#define MAP_SET GroupSet
+#define MAP_SET_FN(a) CAT2(group, a)
+#else
+#define MAP_SET Set
+#define MAP_SET_FN(a) a
+#endif
+
+// Define HASH_MAP_BACKWARD_SHIFT to remove with set_remove_shift instead of tombstones.
+// Removing moves objects, so map_remove returns a copy of the removed object.
+#ifdef HASH_MAP_BACKWARD_SHIFT
+#if defined(HASH_MAP_GROUP) || defined(HASH_MAP_INCREMENTAL)
+#error "HASH_MAP_BACKWARD_SHIFT can't be combined with HASH_MAP_GROUP or HASH_MAP_INCREMENTAL"
+#endif
+#endif
+
+// Define HASH_MAP_INCREMENTAL to grow without a stop-the-world rehash.
+// Growing keeps the old table alive and every insert and remove moves
+// HASH_MAP_MIGRATE_STEP of its keys into the new table, looking at no more
+// than HASH_MAP_MIGRATE_SCAN slots. Lookups check both tables until the
+// migration is done but don't move anything, so pointers they return stay
+// valid until the next insert or remove, which may move the object. Page faults and unmapping are spread out the same way:
+// the next table is created a little before it's needed and faulted in
+// HASH_MAP_PAGE_STEP bytes per call, and the old one is given back as slowly.
+#ifndef HASH_MAP_MIGRATE_STEP
+#define HASH_MAP_MIGRATE_STEP 512
+#endif
+#ifndef HASH_MAP_MIGRATE_SCAN
+#define HASH_MAP_MIGRATE_SCAN 2048
+#endif
+#ifndef HASH_MAP_PAGE_STEP
+#define HASH_MAP_PAGE_STEP ((Usize)64 << 10)
+#endif
+
+// Define HASH_MAP_INLINE to store each key next to its object in one bucket,
+// so a hit touches one cache line instead of two. Best for small objects.
+// Probing, growth and tombstones work the same as Set.
+#ifdef HASH_MAP_INLINE
+#if defined(HASH_MAP_GROUP) || defined(HASH_MAP_INCREMENTAL) || defined(HASH_MAP_BACKWARD_SHIFT)
+#error "HASH_MAP_INLINE can't be combined with other HASH_MAP options"
+#endif
+
+#define MAP_BUCKET NAME(MapBucket)
+
 typedef struct {
-    Set set;
+    HashKey key;
+    HASH_MAP_TYPE object;
+} MAP_BUCKET;
+
+typedef struct {
+    MAP_BUCKET* buckets;
+    U32 mask;
+    U32 count;
+    U32 tombstones;
+    U32 grow_at;
+    F32 max_load;
+} MAP;
+
+MAP NAME(map_create_load)(U32 size, F32 max_load) {
+    U32 mask = set_mask_for(size, max_load, 0);
+    return (MAP) {
+        .buckets = calloc((U64)mask + 1, sizeof(MAP_BUCKET)),
+        .mask = mask,
+        .count = 0,
+        .tombstones = 0,
+        .grow_at = set_load_limit(mask, max_load),
+        .max_load = max_load,
+    };
+}
+
+MAP NAME(map_create)(U32 size) {
+    return NAME(map_create_load)(size, SET_DEFAULT_MAX_LOAD);
+}
+
+// rebuilds the table with room for at least size elements, dropping tombstones
+void NAME(map_rehash)(MAP* map, U32 size) {
+    assert(size >= map->count);
+
+    MAP new_map = NAME(map_create_load)(size, map->max_load);
+    U32 new_mask = new_map.mask;
+
+    for (U64 i = 0; i <= map->mask; ++i) {
+        MAP_BUCKET* b = &map->buckets[i];
+        if (b->key <= 1) { continue; }
+
+        // keys are unique and the new table has no tombstones, take the first empty slot
+        U32 idx = (U32)b->key & new_mask;
+        while (new_map.buckets[idx].key != 0) {
+            idx = (idx + 1) & new_mask;
+        }
+        new_map.buckets[idx] = *b;
+    }
+
+    new_map.count = map->count;
+    free(map->buckets);
+    *map = new_map;
+}
+
+// grows the map so additional more keys can be inserted without rehashing
+void NAME(map_reserve)(MAP* map, U32 additional) {
+    if ((U64)map->count + map->tombstones + additional <= map->grow_at) { return; }
+
+    U32 size = set_grow_size(map->count, map->grow_at, additional);
+    NAME(map_rehash)(map, size);
+}
+
+MAP_BUCKET* NAME(map_find)(MAP* map, HashKey key);
+
+void NAME(map_insert)(MAP* map, HashKey key, HASH_MAP_TYPE val) {
+    assert(key > 1);
+    // only a new key may grow the map
+    if ((U64)map->count + map->tombstones + 1 > map->grow_at && NAME(map_find)(map, key) == NULL) {
+        NAME(map_reserve)(map, 1);
+    }
+
+    U32 mask = map->mask;
+    MAP_BUCKET* buckets = map->buckets;
+
+    // first removed bucket, which is reused if the key isn't further along
+    U32 removed = ~(U32)0;
+
+    U32 idx = (U32)key & mask;
+    HashKey ele = buckets[idx].key;
+    while (ele != 0 && ele != key) {
+        if (ele == 1 && removed == ~(U32)0) { removed = idx; }
+
+        // wrap on overflow size
+        idx = (idx + 1) & mask;
+        ele = buckets[idx].key;
+    }
+
+    if (ele != key) {
+        if (removed != ~(U32)0) {
+            idx = removed;
+            map->tombstones -= 1;
+        }
+        map->count += 1;
+    }
+
+    buckets[idx] = (MAP_BUCKET) { .key = key, .object = val };
+}
+
+// returns the key's bucket, or NULL if not found
+MAP_BUCKET* NAME(map_find)(MAP* map, HashKey key) {
+    U32 mask = map->mask;
+    MAP_BUCKET* buckets = map->buckets;
+
+    U32 idx = (U32)key & mask;
+    while (true) {
+        MAP_BUCKET* b = &buckets[idx];
+        if (b->key == key) { return b; }
+        if (b->key == 0) { return NULL; }
+
+        // wrap on overflow size
+        idx = (idx + 1) & mask;
+    }
+}
+
+// returns NULL if not found
+HASH_MAP_TYPE* NAME(map_lookup)(MAP* map, HashKey key) {
+    MAP_BUCKET* b = NAME(map_find)(map, key);
+    return b == NULL ? NULL : &b->object;
+}
+
+// map_lookup for n keys, out gets the object pointers (NULL if not found).
+// Prefetches buckets ahead of the probes so cache misses overlap.
+void NAME(map_lookup_batch)(MAP* map, const HashKey* keys, HASH_MAP_TYPE** out, U32 n) {
+    U32 mask = map->mask;
+
+    U32 ahead = n < SET_PREFETCH_DISTANCE ? n : SET_PREFETCH_DISTANCE;
+    for (U32 i = 0; i < ahead; ++i) {
+        __builtin_prefetch(&map->buckets[keys[i] & mask]);
+    }
+
+    for (U32 i = 0; i < n; ++i) {
+        if (i + SET_PREFETCH_DISTANCE < n) {
+            __builtin_prefetch(&map->buckets[keys[i + SET_PREFETCH_DISTANCE] & mask]);
+        }
+        out[i] = NAME(map_lookup)(map, keys[i]);
+    }
+}
+
+// returns NULL if not found
+HASH_MAP_TYPE* NAME(map_remove)(MAP* map, HashKey key) {
+    MAP_BUCKET* b = NAME(map_find)(map, key);
+    if (b == NULL) { return NULL; }
+
+    // the object stays in place until the bucket is reused
+    b->key = 1;
+    map->count -= 1;
+    map->tombstones += 1;
+    return &b->object;
+}
+
+// probe and load stats of the buckets, see set_stats
+SetStats NAME(map_stats)(MAP* map) {
+    return set_stats_stride(&map->buckets[0].key, sizeof(MAP_BUCKET), map->mask, map->count, map->tombstones);
+}
+
+void NAME(map_dealloc)(MAP* map) {
+    free(map->buckets);
+}
+
+#else
+
+typedef struct {
+    MAP_SET set;
     HASH_MAP_TYPE* objects;
+#ifdef HASH_MAP_INCREMENTAL
+    MAP_SET old_set;                // keys is NULL if not migrating
+    HASH_MAP_TYPE* old_objects;
+    U32 migrate_pos;                // next slot in old_set to move
+    MAP_SET released_set;           // migrated table being given back, keys is NULL if none
+    HASH_MAP_TYPE* released_objects;
+    U32 release_pos;                // next slot of released_set to give back
+    MAP_SET next_set;               // created ahead of the next grow, keys is NULL if none
+    HASH_MAP_TYPE* next_objects;
+    U32 prefault_pos;               // next slot of next_set to fault in
+#endif
+#ifdef HASH_MAP_BACKWARD_SHIFT
+    HASH_MAP_TYPE removed;          // last object removed
+#endif
 } MAP;
 
 MAP NAME(map_create)(U32 size) {
-    Set set = set_create(size);
+    MAP_SET set = MAP_SET_FN(set_create)(size);
     return (MAP) {
         .set = set,
-        .objects = malloc(((U64)set.mask + 1) * sizeof(HASH_MAP_TYPE))
+        .objects = malloc(((U64)set.mask + 1) * sizeof(HASH_MAP_TYPE)),
+#ifdef HASH_MAP_INCREMENTAL
+        .old_set = (MAP_SET) {0},
+        .old_objects = NULL,
+        .migrate_pos = 0,
+        .released_set = (MAP_SET) {0},
+        .released_objects = NULL,
+        .release_pos = 0,
+        .next_set = (MAP_SET) {0},
+        .next_objects = NULL,
+        .prefault_pos = 0,
+#endif
     };
 }
 
+#ifdef HASH_MAP_INCREMENTAL
+
+// Gives back up to HASH_MAP_PAGE_STEP bytes of the migrated table, or all
+// of it if finish is set. It's freed once every page is released.
+void NAME(map_release)(MAP* map, bool finish) {
+    MAP_SET* set = &map->released_set;
+    if (set->keys == NULL) { return; }
+
+    U64 slots = (U64)set->mask + 1;
+    U64 pos = map->release_pos;
+    U64 end = pos + HASH_MAP_PAGE_STEP / (sizeof(HashKey) + sizeof(HASH_MAP_TYPE));
+    if (finish || end > slots) { end = slots; }
+
+    if (!finish) {
+        vm_release(set->keys, pos * sizeof(HashKey), end * sizeof(HashKey));
+        vm_release(map->released_objects, pos * sizeof(HASH_MAP_TYPE), end * sizeof(HASH_MAP_TYPE));
+#ifdef HASH_MAP_GROUP
+        vm_release(set->ctrl, pos, end);
+#endif
+    }
+
+    map->release_pos = (U32)end;
+    if (end == slots) {
+        MAP_SET_FN(set_dealloc)(set);
+        free(map->released_objects);
+        *set = (MAP_SET) {0};
+        map->released_objects = NULL;
+        map->release_pos = 0;
+    }
+}
+
+// Faults in up to HASH_MAP_PAGE_STEP bytes of the table made for the next grow.
+void NAME(map_prefault)(MAP* map) {
+    MAP_SET* set = &map->next_set;
+    U64 slots = (U64)set->mask + 1;
+    U64 pos = map->prefault_pos;
+    if (set->keys == NULL || pos == slots) { return; }
+
+    U64 end = pos + HASH_MAP_PAGE_STEP / (sizeof(HashKey) + sizeof(HASH_MAP_TYPE));
+    if (end > slots) { end = slots; }
+    vm_prefault(set->keys, pos * sizeof(HashKey), end * sizeof(HashKey));
+    vm_prefault(map->next_objects, pos * sizeof(HASH_MAP_TYPE), end * sizeof(HASH_MAP_TYPE));
+    map->prefault_pos = (U32)end;
+}
+
+// Moves up to keys keys from the old table to the new one, looking at no more
+// than slots slots. Once the old table is empty, releases it a step per call,
+// and after that faults in the next table.
+void NAME(map_migrate)(MAP* map, U64 keys, U64 slots) {
+    MAP_SET* old_set = &map->old_set;
+    if (old_set->keys == NULL) {
+        if (map->released_set.keys != NULL) {
+            NAME(map_release)(map, keys == ~(U64)0);
+        } else if (keys != ~(U64)0) {
+            NAME(map_prefault)(map);
+        }
+        return;
+    }
+
+    U64 pos = map->migrate_pos;
+    U64 end = pos + slots;
+    if (end > (U64)old_set->mask + 1 || slots == ~(U64)0) { end = (U64)old_set->mask + 1; }
+
+    HashKey* old_keys = old_set->keys;
+    U64 moved = 0;
+    for (; pos < end && moved < keys; ++pos) {
+        HashKey key = old_keys[pos];
+        if (key <= 1) { continue; }
+
+        U32 idx = MAP_SET_FN(set_insert)(&map->set, key);
+        map->objects[idx] = map->old_objects[pos];
+        // the old table only keeps keys not moved yet, so a removed key can't come back
+        MAP_SET_FN(set_remove)(old_set, key);
+        moved += 1;
+    }
+
+    map->migrate_pos = (U32)pos;
+    if (pos > old_set->mask) {
+        // only one table is given back at a time
+        NAME(map_release)(map, true);
+        map->released_set = *old_set;
+        map->released_objects = map->old_objects;
+        map->release_pos = 0;
+        *old_set = (MAP_SET) {0};
+        map->old_objects = NULL;
+        map->migrate_pos = 0;
+        if (keys == ~(U64)0) { NAME(map_release)(map, true); }
+    }
+}
+
+// Size of the table to migrate to once count keys are left, big enough to take
+// every old key plus one insert per call without growing before the migration
+// finishes, since every call moves at least HASH_MAP_MIGRATE_STEP slots.
+static U32 NAME(map_grow_size)(const MAP_SET* set, U32 count) {
+    U32 size = set_grow_size(count, set->grow_at, 1);
+    U64 min_size = (U64)count + ((U64)set->mask + 1) / HASH_MAP_MIGRATE_STEP + 2;
+    return size < min_size ? (U32)min_size : size;
+}
+
+// Starts migrating to a larger table if inserting a key would pass max_load.
+// Once the inserts left before that could fault in a table twice the size at
+// HASH_MAP_PAGE_STEP bytes each, creates it so map_migrate can start on it.
+void NAME(map_grow_incremental)(MAP* map) {
+    MAP_SET* set = &map->set;
+    U64 used = (U64)set->count + set->tombstones + 1;
+    if (used <= set->grow_at) {
+        U64 ahead = ((U64)set->mask + 1) * 2 * (sizeof(HashKey) + sizeof(HASH_MAP_TYPE)) / HASH_MAP_PAGE_STEP + 1;
+        if (used + ahead > set->grow_at && map->next_set.keys == NULL && map->old_set.keys == NULL) {
+            U32 size = NAME(map_grow_size)(set, set->grow_at - set->tombstones);
+            map->next_set = MAP_SET_FN(set_create_load)(size, set->max_load);
+            map->next_objects = malloc(((U64)map->next_set.mask + 1) * sizeof(HASH_MAP_TYPE));
+            map->prefault_pos = 0;
+        }
+        return;
+    }
+
+    // finish the previous migration, only reached if the steps are too small
+    NAME(map_migrate)(map, ~(U64)0, ~(U64)0);
+
+    // the table made ahead is too small if a map_reserve grew this one since
+    U32 size = NAME(map_grow_size)(set, set->count);
+    if (map->next_set.keys != NULL && map->next_set.grow_at < size) {
+        MAP_SET_FN(set_dealloc)(&map->next_set);
+        free(map->next_objects);
+        map->next_set = (MAP_SET) {0};
+    }
+
+    map->old_set = *set;
+    map->old_objects = map->objects;
+    map->migrate_pos = 0;
+
+    if (map->next_set.keys != NULL) {
+        *set = map->next_set;
+        map->objects = map->next_objects;
+        map->next_set = (MAP_SET) {0};
+        map->next_objects = NULL;
+    } else {
+        *set = MAP_SET_FN(set_create_load)(size, set->max_load);
+        map->objects = malloc(((U64)set->mask + 1) * sizeof(HASH_MAP_TYPE));
+    }
+}
+
+#endif
+
+// grows the map so additional more keys can be inserted without rehashing
+// with HASH_MAP_INCREMENTAL this finishes any migration and rehashes at once
+void NAME(map_reserve)(MAP* map, U32 additional) {
+#ifdef HASH_MAP_INCREMENTAL
+    NAME(map_migrate)(map, ~(U64)0, ~(U64)0);
+#endif
+    map->objects = MAP_SET_FN(set_reserve)(&map->set, additional, map->objects, sizeof(HASH_MAP_TYPE));
+}
+
 void NAME(map_insert)(MAP* map, HashKey key, HASH_MAP_TYPE val) {
-    U32 idx = set_insert(&map->set, key);
+#ifdef HASH_MAP_INCREMENTAL
+    NAME(map_migrate)(map, HASH_MAP_MIGRATE_STEP, HASH_MAP_MIGRATE_SCAN);
+    NAME(map_grow_incremental)(map);
+
+    // the new value replaces any copy still in the old table
+    if (map->old_set.keys != NULL) {
+        MAP_SET_FN(set_remove)(&map->old_set, key);
+    }
+#else
+    // grow here so objects move along with the keys, only for a new key
+    MAP_SET* set = &map->set;
+    if ((U64)set->count + set->tombstones + 1 > set->grow_at
+            && (MAP_SET_FN(set_lookup)(set, key) & 1) == 0) {
+        NAME(map_reserve)(map, 1);
+    }
+#endif
+    U32 idx = MAP_SET_FN(set_insert)(&map->set, key);
     map->objects[idx] = val;
 }
 
 // returns NULL if not found
 HASH_MAP_TYPE* NAME(map_lookup)(MAP* map, HashKey key) {
-    U64 ret = set_lookup(&map->set, key);
-    if ((ret & 1) == 0) { return NULL; }
+    U64 ret = MAP_SET_FN(set_lookup)(&map->set, key);
+    if ((ret & 1) == 1) { return &map->objects[ret >> 32]; }
+
+#ifdef HASH_MAP_INCREMENTAL
+    if (map->old_set.keys != NULL) {
+        ret = MAP_SET_FN(set_lookup)(&map->old_set, key);
+        if ((ret & 1) == 1) { return &map->old_objects[ret >> 32]; }
+    }
+#endif
+    return NULL;
+}
+
+// map_lookup for n keys, out gets the object pointers (NULL if not found).
+// Lookups are batched so cache misses overlap, and found objects are prefetched.
+void NAME(map_lookup_batch)(MAP* map, const HashKey* keys, HASH_MAP_TYPE** out, U32 n) {
+    U64 found[256];
+    for (U32 start = 0; start < n; start += 256) {
+        U32 len = n - start < 256 ? n - start : 256;
+        MAP_SET_FN(set_lookup_batch)(&map->set, keys + start, found, len);
 
-    U64 idx = ret >> 32;
-    return &map->objects[idx];
+        for (U32 i = 0; i < len; ++i) {
+            HASH_MAP_TYPE* obj = NULL;
+            if ((found[i] & 1) == 1) {
+                obj = &map->objects[found[i] >> 32];
+                __builtin_prefetch(obj);
+            }
+#ifdef HASH_MAP_INCREMENTAL
+            else if (map->old_set.keys != NULL) {
+                U64 ret = MAP_SET_FN(set_lookup)(&map->old_set, keys[start + i]);
+                if ((ret & 1) == 1) { obj = &map->old_objects[ret >> 32]; }
+            }
+#endif
+            out[start + i] = obj;
+        }
+    }
 }
 
 // returns NULL if not found
+// with HASH_MAP_BACKWARD_SHIFT, points to a copy that is valid until the next map_remove
 HASH_MAP_TYPE* NAME(map_remove)(MAP* map, HashKey key) {
-    U64 ret = set_remove(&map->set, key);
+#ifdef HASH_MAP_BACKWARD_SHIFT
+    U64 ret = set_lookup(&map->set, key);
     if ((ret & 1) == 0) { return NULL; }
 
-    U64 idx = ret >> 32;
-    return &map->objects[idx];
+    U32 idx = (U32)(ret >> 32);
+    map->removed = map->objects[idx];
+    set_remove_at(&map->set, idx, map->objects, sizeof(HASH_MAP_TYPE));
+    return &map->removed;
+#else
+#ifdef HASH_MAP_INCREMENTAL
+    NAME(map_migrate)(map, HASH_MAP_MIGRATE_STEP, HASH_MAP_MIGRATE_SCAN);
+#endif
+    U64 ret = MAP_SET_FN(set_remove)(&map->set, key);
+    if ((ret & 1) == 1) { return &map->objects[ret >> 32]; }
+
+#ifdef HASH_MAP_INCREMENTAL
+    if (map->old_set.keys != NULL) {
+        ret = MAP_SET_FN(set_remove)(&map->old_set, key);
+        if ((ret & 1) == 1) { return &map->old_objects[ret >> 32]; }
+    }
+#endif
+    return NULL;
+#endif
+}
+
+// probe and load stats of the set, see set_stats.
+// With HASH_MAP_INCREMENTAL keys not migrated yet are not counted.
+SetStats NAME(map_stats)(MAP* map) {
+    return MAP_SET_FN(set_stats)(&map->set);
 }
 
-// returns NULL if not found
+#if !defined(HASH_MAP_GROUP) && !defined(HASH_MAP_INCREMENTAL)
+
+// writes the map to path, see set_save
+// returns 0 on success, 1 on failure
+int NAME(map_save)(MAP* map, const char* path) {
+    return set_save(&map->set, map->objects, sizeof(HASH_MAP_TYPE), path);
+}
+
+// Maps a file written by map_save read-only, see set_open_mmap.
+// Only map_lookup and map_lookup_batch may be used, close with map_close_mmap.
+// returns 0 on success, 1 on failure
+int NAME(map_open_mmap)(MAP* map, const char* path) {
+    void* objects;
+    if (set_open_mmap(&map->set, &objects, sizeof(HASH_MAP_TYPE), path) != 0) { return 1; }
+    map->objects = objects;
+    return 0;
+}
+
+void NAME(map_close_mmap)(MAP* map) {
+    set_close_mmap(&map->set, sizeof(HASH_MAP_TYPE));
+}
+
+#endif
+
 void NAME(map_dealloc)(MAP* map) {
-    set_dealloc(&map->set);
+    MAP_SET_FN(set_dealloc)(&map->set);
     free(map->objects);
+#ifdef HASH_MAP_INCREMENTAL
+    if (map->old_set.keys != NULL) {
+        MAP_SET_FN(set_dealloc)(&map->old_set);
+        free(map->old_objects);
+    }
+    NAME(map_release)(map, true);
+    if (map->next_set.keys != NULL) {
+        MAP_SET_FN(set_dealloc)(&map->next_set);
+        free(map->next_objects);
+    }
+#endif
 }
 
+#endif
+
 #undef HASH_MAP_TYPE
+#undef HASH_MAP_GROUP
+#undef HASH_MAP_INCREMENTAL
+#undef HASH_MAP_BACKWARD_SHIFT
+#undef HASH_MAP_INLINE
+#undef HASH_MAP_MIGRATE_STEP
+#undef HASH_MAP_MIGRATE_SCAN
+#undef HASH_MAP_PAGE_STEP
 #undef NAME
 #undef MAP
+#undef MAP_SET
+#undef MAP_SET_FN
+#undef MAP_BUCKET
 
 #endif
 #endif
@@ -0,0 +1,315 @@
+#ifndef TOOLS_H
+#error "please include tools.h before including pool.h"
+#else
+
+#ifndef POOL_TYPE
+#error "POOL_TYPE must be defined before including pool.h"
+#else
+
+// Fixed size objects carved out of POOL_SLAB_SIZE slabs, alloc and free are O(1).
+// Slabs are aligned to their size, so free finds the slab header from the pointer.
+// Each slab keeps its own free list and the pool links the slabs with free
+// slots. Full slabs aren't linked there, so filling and freeing from them
+// doesn't touch other slabs. Slabs that empty are kept for reuse up to
+// POOL_EMPTY_MAX, past that they're unmapped.
+//
+// pool_alloc and pool_free are not thread safe. Threads sharing a pool each
+// keep a PoolCache and only use pool_cache_alloc and pool_cache_free, which go
+// to the pool in batches of POOL_CACHE_BATCH under a spin lock. A cache fills
+// and empties its free list, keeping one full batch aside, and only goes to the
+// pool when it needs a second one or has nowhere to put one. Batches given to
+// the pool are kept whole, up to POOL_BATCH_MAX of them, and handed to the next
+// cache that runs out, so a batch moves in O(1) either way. Objects in kept
+// batches still count as used by their slabs until pool_trim.
+
+#ifndef POOL_SLAB_SIZE
+#define POOL_SLAB_SIZE ((Usize)64 << 10)
+#endif
+#ifndef POOL_CACHE_BATCH
+#define POOL_CACHE_BATCH 64
+#endif
+#ifndef POOL_EMPTY_MAX
+#define POOL_EMPTY_MAX 16
+#endif
+#ifndef POOL_BATCH_MAX
+#define POOL_BATCH_MAX 32
+#endif
+
+#ifndef POOL_COMMON
+#define POOL_COMMON
+
+// objects start on the first cache line after the header
+#define POOL_HEADER_SIZE 64
+
+#if defined(__x86_64__) || defined(__i386__)
+#define POOL_PAUSE() __builtin_ia32_pause()
+#else
+#define POOL_PAUSE() ((void)0)
+#endif
+
+typedef struct PoolSlab {
+    struct PoolSlab* prev;      // neighbours in the pool's partial or empty list, unlinked while full
+    struct PoolSlab* next;
+    struct PoolSlab* mapped_prev;   // neighbours in the list of every mapped slab
+    struct PoolSlab* mapped_next;
+    void* free;                 // freed slots, linked through their first word
+    U32 used;
+    U32 carved;                 // slots past this were never handed out
+} PoolSlab;
+
+// Objects freed by one thread, owned by that thread. Starts zeroed.
+typedef struct {
+    void* free;
+    U32 count;                  // objects in free
+    void* batch;                // a full batch kept aside, or NULL
+} PoolCache;
+
+#endif
+
+#define NAME(a) CAT2(a, POOL_TYPE)
+
+#define POOL NAME(Pool)
+// slots hold a free list link while free
+#define POOL_SLOT_SIZE ((sizeof(POOL_TYPE) + 7) & ~(Usize)7)
+#define POOL_SLOT_NUM ((U32)((POOL_SLAB_SIZE - POOL_HEADER_SIZE) / POOL_SLOT_SIZE))
+
+typedef struct {
+    PoolSlab* partial;          // slabs with free slots, the head is allocated from
+    PoolSlab* empty;            // kept instead of unmapped, only linked through next
+    PoolSlab* mapped;           // every slab, for pool_dealloc
+    U32 empty_num;
+    U32 slabs;                  // mapped, including empty
+    void* batches[POOL_BATCH_MAX];  // full batches given back by caches
+    U32 batch_num;
+    bool lock;                  // only taken by the cache functions
+} POOL;
+
+POOL NAME(pool_create)(void) {
+    static_assert(_Alignof(POOL_TYPE) <= POOL_HEADER_SIZE, "POOL_TYPE alignment is too large");
+    static_assert(POOL_SLAB_SIZE >= POOL_HEADER_SIZE + 8 * POOL_SLOT_SIZE, "POOL_SLAB_SIZE is too small for POOL_TYPE");
+    static_assert((POOL_SLAB_SIZE & (POOL_SLAB_SIZE - 1)) == 0, "POOL_SLAB_SIZE must be a power of 2");
+    // the smallest page size, pool_new_slab checks the real one
+    static_assert(POOL_SLAB_SIZE >= 4096, "POOL_SLAB_SIZE must be at least the page size");
+
+    return (POOL) {
+        .partial = NULL,
+        .empty = NULL,
+        .mapped = NULL,
+        .empty_num = 0,
+        .slabs = 0,
+        .batch_num = 0,
+        .lock = false,
+    };
+}
+
+static PoolSlab* NAME(pool_slab_of)(POOL_TYPE* e) {
+    return (PoolSlab*)(void*)((Usize)e & ~(POOL_SLAB_SIZE - 1));
+}
+
+static void NAME(pool_unlink)(PoolSlab** list, PoolSlab* slab) {
+    if (slab->prev != NULL) { slab->prev->next = slab->next; } else { *list = slab->next; }
+    if (slab->next != NULL) { slab->next->prev = slab->prev; }
+}
+
+static void NAME(pool_push)(PoolSlab** list, PoolSlab* slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list != NULL) { (*list)->prev = slab; }
+    *list = slab;
+}
+
+// returns false if out of memory
+static bool NAME(pool_new_slab)(POOL* pool) {
+    PoolSlab* slab = pool->empty;
+    if (slab != NULL) {
+        pool->empty = slab->next;
+        pool->empty_num -= 1;
+    } else {
+        assert(POOL_SLAB_SIZE >= page_size());
+        slab = vm_alloc_aligned(POOL_SLAB_SIZE, POOL_SLAB_SIZE);
+        if (slab == MAP_FAILED) { return false; }
+        pool->slabs += 1;
+
+        slab->mapped_prev = NULL;
+        slab->mapped_next = pool->mapped;
+        if (pool->mapped != NULL) { pool->mapped->mapped_prev = slab; }
+        pool->mapped = slab;
+    }
+
+    slab->free = NULL;
+    slab->used = 0;
+    slab->carved = 0;
+    NAME(pool_push)(&pool->partial, slab);
+    return true;
+}
+
+static void NAME(pool_unmap)(POOL* pool, PoolSlab* slab) {
+    if (slab->mapped_prev != NULL) { slab->mapped_prev->mapped_next = slab->mapped_next; } else { pool->mapped = slab->mapped_next; }
+    if (slab->mapped_next != NULL) { slab->mapped_next->mapped_prev = slab->mapped_prev; }
+    vm_dealloc(slab, POOL_SLAB_SIZE);
+    pool->slabs -= 1;
+}
+
+// Not zeroed. returns NULL if out of memory
+POOL_TYPE* NAME(pool_alloc)(POOL* pool) {
+    if (pool->partial == NULL && !NAME(pool_new_slab)(pool)) { return NULL; }
+
+    PoolSlab* slab = pool->partial;
+    void* e = slab->free;
+    if (e != NULL) {
+        slab->free = *(void**)e;
+    } else {
+        e = (U8*)slab + POOL_HEADER_SIZE + (Usize)slab->carved * POOL_SLOT_SIZE;
+        slab->carved += 1;
+    }
+
+    slab->used += 1;
+    if (slab->used == POOL_SLOT_NUM) { NAME(pool_unlink)(&pool->partial, slab); }
+    return e;
+}
+
+void NAME(pool_free)(POOL* pool, POOL_TYPE* e) {
+    if (e == NULL) { return; }
+
+    PoolSlab* slab = NAME(pool_slab_of)(e);
+    *(void**)(void*)e = slab->free;
+    slab->free = e;
+
+    if (slab->used == POOL_SLOT_NUM) { NAME(pool_push)(&pool->partial, slab); }
+    slab->used -= 1;
+
+    if (slab->used == 0) {
+        NAME(pool_unlink)(&pool->partial, slab);
+        if (pool->empty_num < POOL_EMPTY_MAX) {
+            slab->next = pool->empty;
+            pool->empty = slab;
+            pool->empty_num += 1;
+        } else {
+            NAME(pool_unmap)(pool, slab);
+        }
+    }
+}
+
+static void NAME(pool_lock)(POOL* pool) {
+    while (__atomic_test_and_set(&pool->lock, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&pool->lock, __ATOMIC_RELAXED)) { POOL_PAUSE(); }
+    }
+}
+
+static void NAME(pool_unlock)(POOL* pool) {
+    __atomic_clear(&pool->lock, __ATOMIC_RELEASE);
+}
+
+// frees a NULL terminated list of objects
+static void NAME(pool_free_list)(POOL* pool, void* list) {
+    while (list != NULL) {
+        void* next = *(void**)list;
+        NAME(pool_free)(pool, list);
+        list = next;
+    }
+}
+
+// Takes from cache, refilling it with POOL_CACHE_BATCH objects when empty.
+// returns NULL if out of memory
+POOL_TYPE* NAME(pool_cache_alloc)(POOL* pool, PoolCache* cache) {
+    if (cache->free == NULL) {
+        if (cache->batch != NULL) {
+            cache->free = cache->batch;
+            cache->batch = NULL;
+            cache->count = POOL_CACHE_BATCH;
+        } else {
+            NAME(pool_lock)(pool);
+            if (pool->batch_num > 0) {
+                pool->batch_num -= 1;
+                cache->free = pool->batches[pool->batch_num];
+                cache->count = POOL_CACHE_BATCH;
+            } else {
+                for (U32 i = 0; i < POOL_CACHE_BATCH; ++i) {
+                    POOL_TYPE* e = NAME(pool_alloc)(pool);
+                    if (e == NULL) { break; }
+                    *(void**)(void*)e = cache->free;
+                    cache->free = e;
+                    cache->count += 1;
+                }
+            }
+            NAME(pool_unlock)(pool);
+            if (cache->free == NULL) { return NULL; }
+        }
+    }
+
+    void* e = cache->free;
+    cache->free = *(void**)e;
+    cache->count -= 1;
+    return e;
+}
+
+// Puts e in cache. A free list of POOL_CACHE_BATCH objects is set aside whole,
+// and the batch it replaces goes to the pool, or back to its slabs if
+// POOL_BATCH_MAX are kept already.
+void NAME(pool_cache_free)(POOL* pool, PoolCache* cache, POOL_TYPE* e) {
+    if (e == NULL) { return; }
+
+    *(void**)(void*)e = cache->free;
+    cache->free = e;
+    cache->count += 1;
+    if (cache->count < POOL_CACHE_BATCH) { return; }
+
+    if (cache->batch != NULL) {
+        NAME(pool_lock)(pool);
+        if (pool->batch_num < POOL_BATCH_MAX) {
+            pool->batches[pool->batch_num] = cache->batch;
+            pool->batch_num += 1;
+        } else {
+            NAME(pool_free_list)(pool, cache->batch);
+        }
+        NAME(pool_unlock)(pool);
+    }
+    cache->batch = cache->free;
+    cache->free = NULL;
+    cache->count = 0;
+}
+
+// returns every cached object to the pool, call it before the cache's thread exits
+void NAME(pool_cache_flush)(POOL* pool, PoolCache* cache) {
+    NAME(pool_lock)(pool);
+    NAME(pool_free_list)(pool, cache->free);
+    NAME(pool_free_list)(pool, cache->batch);
+    NAME(pool_unlock)(pool);
+    *cache = (PoolCache) { .free = NULL, .count = 0, .batch = NULL };
+}
+
+// Returns the kept batches to their slabs and unmaps the empty ones.
+// Not thread safe, no cache may be in use.
+void NAME(pool_trim)(POOL* pool) {
+    for (U32 i = 0; i < pool->batch_num; ++i) { NAME(pool_free_list)(pool, pool->batches[i]); }
+    pool->batch_num = 0;
+
+    PoolSlab* slab = pool->empty;
+    while (slab != NULL) {
+        PoolSlab* next = slab->next;
+        NAME(pool_unmap)(pool, slab);
+        slab = next;
+    }
+    pool->empty = NULL;
+    pool->empty_num = 0;
+}
+
+// Frees every slab, live objects included. Caches must be flushed or dropped first.
+void NAME(pool_dealloc)(POOL* pool) {
+    PoolSlab* slab = pool->mapped;
+    while (slab != NULL) {
+        PoolSlab* next = slab->mapped_next;
+        vm_dealloc(slab, POOL_SLAB_SIZE);
+        slab = next;
+    }
+    *pool = NAME(pool_create)();
+}
+
+#undef POOL_TYPE
+#undef NAME
+#undef POOL
+#undef POOL_SLOT_SIZE
+#undef POOL_SLOT_NUM
+
+#endif
+#endif
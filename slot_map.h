@@ -0,0 +1,119 @@
+#ifndef TOOLS_H
+#error "please include tools.h before including slot_map.h"
+#else
+
+#ifndef SLOT_MAP_TYPE
+#error "SLOT_MAP_TYPE must be defined before including slot_map.h"
+#else
+
+// Arena with the live values packed at the front of values[0..len).
+// Keys are handed out by an ArenaTracking and stay valid until removed, same as
+// arena.h. Removing moves the last value into the hole, so pointers and
+// dense indices are only stable until the next remove.
+
+#define NAME(a) CAT2(a, SLOT_MAP_TYPE)
+
+#define SLOT_MAP NAME(SlotMap)
+
+typedef struct {
+    ArenaTracking tracking;
+    ArenaIdx* dense;        // slot -> index into values
+    ArenaIdx* slots;        // index into values -> slot, to fix up dense on remove
+    SLOT_MAP_TYPE* values;
+    U32 len;
+    U32 committed;
+} SLOT_MAP;
+
+// tracking.free is NULL on failure.
+SLOT_MAP NAME(slot_map_create)(void) {
+    ArenaTracking tracking = arena_tracking_create();
+    if (tracking.free == NULL) { return (SLOT_MAP) { .tracking = tracking }; }
+
+    ArenaIdx* dense = vm_reserve(ARENA_MAX_ELEMENTS * sizeof(ArenaIdx));
+    ArenaIdx* slots = vm_reserve(ARENA_MAX_ELEMENTS * sizeof(ArenaIdx));
+    SLOT_MAP_TYPE* values = vm_reserve(ARENA_MAX_ELEMENTS * sizeof(SLOT_MAP_TYPE));
+    if (dense == MAP_FAILED || slots == MAP_FAILED || values == MAP_FAILED) {
+        if (dense != MAP_FAILED) { vm_dealloc(dense, ARENA_MAX_ELEMENTS * sizeof(ArenaIdx)); }
+        if (slots != MAP_FAILED) { vm_dealloc(slots, ARENA_MAX_ELEMENTS * sizeof(ArenaIdx)); }
+        if (values != MAP_FAILED) { vm_dealloc(values, ARENA_MAX_ELEMENTS * sizeof(SLOT_MAP_TYPE)); }
+        arena_tracking_dealloc(&tracking);
+        return (SLOT_MAP) { .tracking = { .free = NULL } };
+    }
+
+    return (SLOT_MAP) {
+        .tracking = tracking,
+        .dense = dense,
+        .slots = slots,
+        .values = values,
+        .len = 0,
+        .committed = 0,
+    };
+}
+
+// the key's idx is ARENA_INVALID_IDX if memory for a new slot can't be committed
+ArenaKey NAME(slot_map_insert)(SLOT_MAP* map, SLOT_MAP_TYPE e) {
+    ArenaKey k = arena_tracking_insert(&map->tracking);
+    if (k.idx == ARENA_INVALID_IDX) { return k; }
+
+    if (k.idx >= map->committed) {
+        Usize old = map->committed;
+        U32 target = map->tracking.committed;
+        if (vm_commit_grow(map->dense, old * sizeof(ArenaIdx), (Usize)target * sizeof(ArenaIdx), 0) != 0
+                || vm_commit_grow(map->slots, old * sizeof(ArenaIdx), (Usize)target * sizeof(ArenaIdx), 0) != 0
+                || vm_commit_grow(map->values, old * sizeof(SLOT_MAP_TYPE), (Usize)target * sizeof(SLOT_MAP_TYPE), 0) != 0) {
+            arena_tracking_remove(&map->tracking, k);
+            return (ArenaKey) { .idx = ARENA_INVALID_IDX, .gen = 0 };
+        }
+        map->committed = target;
+    }
+
+    U32 idx = map->len;
+    map->dense[k.idx] = (ArenaIdx)idx;
+    map->slots[idx] = k.idx;
+    map->values[idx] = e;
+    map->len += 1;
+    return k;
+}
+
+// returns NULL if k was removed
+SLOT_MAP_TYPE* NAME(slot_map_lookup)(SLOT_MAP* map, ArenaKey k) {
+    if (!arena_tracking_key_valid(&map->tracking, k)) return NULL;
+    return &map->values[map->dense[k.idx]];
+}
+
+// key of values[idx]
+ArenaKey NAME(slot_map_key)(SLOT_MAP* map, U32 idx) {
+    ArenaIdx slot = map->slots[idx];
+    return (ArenaKey) {
+        .gen = map->tracking.generations[slot],
+        .idx = slot,
+    };
+}
+
+void NAME(slot_map_remove)(SLOT_MAP* map, ArenaKey k) {
+    if (!arena_tracking_key_valid(&map->tracking, k)) return;
+
+    // move the last value into the hole
+    ArenaIdx idx = map->dense[k.idx];
+    U32 last = map->len - 1;
+    map->values[idx] = map->values[last];
+    map->slots[idx] = map->slots[last];
+    map->dense[map->slots[idx]] = idx;
+    map->len = last;
+
+    arena_tracking_remove(&map->tracking, k);
+}
+
+void NAME(slot_map_dealloc)(SLOT_MAP* map) {
+    vm_dealloc(map->dense, ARENA_MAX_ELEMENTS * sizeof(ArenaIdx));
+    vm_dealloc(map->slots, ARENA_MAX_ELEMENTS * sizeof(ArenaIdx));
+    vm_dealloc(map->values, ARENA_MAX_ELEMENTS * sizeof(SLOT_MAP_TYPE));
+    arena_tracking_dealloc(&map->tracking);
+}
+
+#undef SLOT_MAP_TYPE
+#undef NAME
+#undef SLOT_MAP
+
+#endif
+#endif
@@ -1,11 +1,64 @@
 #include "tools.h"
+#include <pthread.h>
 
 #define STACK_TYPE U32
 #include "stack.h"
 
+#define ARENA_TYPE U64
+#include "arena.h"
+
+#define SLOT_MAP_TYPE U64
+#include "slot_map.h"
+
+#define POOL_TYPE U64
+#include "pool.h"
+
+// size not a multiple of 8
+typedef struct {
+    U32 v[3];
+} PoolTriple;
+
+#define POOL_TYPE PoolTriple
+#include "pool.h"
+
 #define HASH_MAP_TYPE U32
 #include "map.h"
 
+#define HASH_MAP_TYPE U64
+#define HASH_MAP_GROUP
+#include "map.h"
+
+// small steps so migrations and releases span many calls
+#define HASH_MAP_TYPE I64
+#define HASH_MAP_INCREMENTAL
+#define HASH_MAP_MIGRATE_STEP 2
+#define HASH_MAP_MIGRATE_SCAN 8
+#define HASH_MAP_PAGE_STEP ((Usize)4 << 10)
+#include "map.h"
+
+#define HASH_MAP_TYPE F64
+#define HASH_MAP_BACKWARD_SHIFT
+#include "map.h"
+
+#define HASH_MAP_TYPE U16
+#define HASH_MAP_INLINE
+#include "map.h"
+
+#define KEY_MAP_KEY String
+#define KEY_MAP_VALUE U32
+#define KEY_MAP_HASH(k) hash_bytes((U8*)(k).ptr, (k).len)
+#define KEY_MAP_EQUAL(a, b) string_equals(a, b)
+#include "key_map.h"
+
+// every key collides with an eighth of the others, including on the hashes 0 and 1
+#define KEY_MAP_KEY U64
+#define KEY_MAP_VALUE U64
+#define KEY_MAP_HASH(k) (HashKey)((k) & 7)
+#include "key_map.h"
+
+#define CONCURRENT_MAP_TYPE U32
+#include "concurrent_map.h"
+
 int test_bump(void) {
     BumpList b = bump_list_create();
     Prng p = prng_create(0);
@@ -45,6 +98,264 @@ int test_bump(void) {
     return 0;
 }
 
+int test_bump_mark(void) {
+    Timer t = timer_start();
+    BumpList b = bump_list_create();
+
+    // mark on an empty list goes back to empty
+    BumpMark empty = bump_list_mark(&b);
+    bump_list_alloc(&b, 100, 8);
+    bump_list_restore(&b, empty);
+    assert(~(Usize)b.alloc_start == 0);
+
+    U64* outer = bump_list_alloc(&b, 100 * sizeof(U64), sizeof(U64));
+    for (U64 i = 0; i < 100; ++i) { outer[i] = i; }
+
+    BumpMark m1 = bump_list_mark(&b);
+    for (U64 i = 0; i < 1000; ++i) { memset(bump_list_alloc(&b, 512, 16), 0xff, 512); }
+    BumpMark m2 = bump_list_mark(&b);
+    for (U64 i = 0; i < 1000; ++i) { memset(bump_list_alloc(&b, 512, 16), 0xee, 512); }
+    assert(b.alloc_start != m2.alloc_start);
+
+    bump_list_restore(&b, m2);
+    assert(b.alloc_start == m2.alloc_start && b.pos == m2.pos);
+    bump_list_restore(&b, m1);
+    assert(b.alloc_start == m1.alloc_start && b.pos == m1.pos);
+
+    for (U64 i = 0; i < 100; ++i) { assert(outer[i] == i); }
+    U8* again = bump_list_alloc(&b, 8, 8);
+    assert(again == m1.pos - 8);
+
+    // released pages come back before any new ones are mapped
+    BumpPageCounters before = bump_page_counters();
+    U8* start = b.alloc_start;
+    while (b.alloc_start == start) { bump_list_alloc(&b, 512, 16); }
+    assert(bump_page_counters().maps == before.maps);
+    assert(bump_page_counters().reuses == before.reuses + 1);
+
+    bump_list_dealloc(&b);
+
+    printf("%fus\n", timer_elapsed_us(&t));
+
+    return 0;
+}
+
+int test_bump_page_cache(void) {
+    Timer t = timer_start();
+    Usize page = page_size() * BUMP_PAGE_ALLOC_COUNT;
+    bump_page_cache_trim();
+    bump_page_counters_reset();
+
+    // after the first frame, frames only reuse cached pages
+    BumpList b = bump_list_create();
+    for (U64 frame = 0; frame < 10; ++frame) {
+        for (U64 i = 0; i < 1000; ++i) { memset(bump_list_alloc(&b, 1000, 8), (int)i, 1000); }
+        bump_list_clear(&b);
+    }
+    BumpPageCounters c = bump_page_counters();
+    U64 pages = c.maps;
+    assert(pages > 1 && c.unmaps == 0);
+    assert(c.reuses == 9 * (pages - 1));
+    assert(c.cached == (pages - 1) * page);
+
+    // lowering the limit unmaps the extra pages, nothing is cached past it
+    bump_page_cache_limit(2 * page);
+    bump_list_dealloc(&b);
+    c = bump_page_counters();
+    assert(c.cached == 2 * page && c.unmaps == pages - 2);
+
+    bump_page_cache_limit(0);
+    assert(bump_page_counters().cached == 0);
+    b = bump_list_create();
+    bump_list_alloc(&b, 8, 8);
+    assert(bump_page_counters().maps == c.maps + 1);
+    bump_list_dealloc(&b);
+    assert(bump_page_counters().unmaps == c.unmaps + 3);
+
+    bump_page_cache_trim();
+    assert(bump_page_counters().cached == 0);
+    bump_page_cache_limit(BUMP_PAGE_CACHE_LIMIT);
+
+    printf("%fus\n", timer_elapsed_us(&t));
+
+    return 0;
+}
+
+// sums 1..n in scratch memory, the result goes to the caller's list
+static U64* test_scratch_sum(BumpList* out, U64 n) {
+    Scratch s = scratch_get(&out, 1);
+    assert(s.bump != out);
+    U64* tmp = bump_list_alloc(s.bump, n * sizeof(U64), sizeof(U64));
+    for (U64 i = 0; i < n; ++i) { tmp[i] = i + 1; }
+
+    U64* sum = bump_list_alloc(out, sizeof(U64), sizeof(U64));
+    *sum = 0;
+    for (U64 i = 0; i < n; ++i) { *sum += tmp[i]; }
+
+    scratch_release(s);
+    return sum;
+}
+
+static void* test_scratch_thread(void* arg) {
+    U64 seed = (U64)arg;
+    for (U64 round = 0; round < 100; ++round) {
+        Scratch outer = scratch_get(NULL, 0);
+        U64 n = seed * 1000 + round;
+        U64* sum = test_scratch_sum(outer.bump, n);
+        assert(*sum == n * (n + 1) / 2);
+        scratch_release(outer);
+        assert(outer.bump->pos == outer.mark.pos);
+    }
+    scratch_dealloc();
+    return NULL;
+}
+
+// leaves a cached page and its scratch lists for the thread exit destructor
+static void* test_scratch_exit_thread(void* arg) {
+    BumpList b = bump_list_create();
+    bump_list_alloc(&b, 64, 8);
+    *(U8**)arg = b.alloc_start;
+    bump_list_dealloc(&b);
+    assert(bump_page_counters().cached > 0);
+    scratch_get(NULL, 0);
+    return NULL;
+}
+
+int test_scratch(void) {
+    Timer t = timer_start();
+
+    // the same list comes back when nothing conflicts
+    Scratch a = scratch_get(NULL, 0);
+    Scratch b = scratch_get(&a.bump, 1);
+    assert(a.bump != b.bump);
+    scratch_release(b);
+    scratch_release(a);
+    assert(scratch_get(NULL, 0).bump == a.bump);
+
+    pthread_t threads[4];
+    for (U64 i = 0; i < 4; ++i) { pthread_create(&threads[i], NULL, test_scratch_thread, (void*)(i + 1)); }
+    for (U64 i = 0; i < 4; ++i) { pthread_join(threads[i], NULL); }
+
+    // mincore fails on unmapped memory
+    U8* page = NULL;
+    U8 resident;
+    pthread_create(&threads[0], NULL, test_scratch_exit_thread, &page);
+    pthread_join(threads[0], NULL);
+    assert(page != NULL && mincore(page, page_size(), &resident) != 0);
+
+    scratch_dealloc();
+    assert(bump_page_counters().cached == 0);
+
+    printf("%fus\n", timer_elapsed_us(&t));
+
+    return 0;
+}
+
+int test_hash(void) {
+    Timer timer = timer_start();
+
+    U8 buf[256];
+    for (U32 i = 0; i < sizeof(buf); ++i) { buf[i] = (U8)(i * 7 + 1); }
+
+    // every prefix length goes through a different path, none should collide
+    Set seen = set_create(1024);
+    for (U64 len = 0; len <= sizeof(buf); ++len) {
+        U64 h = hash_bytes_64(buf, len);
+        assert(h == hash_bytes_64_seed(buf, len, 0));
+        assert(h != hash_bytes_64_seed(buf, len, 1));
+        HashKey k = (HashKey)(h | 2);
+        assert((set_lookup(&seen, k) & 1) == 0);
+        set_insert(&seen, k);
+    }
+    set_dealloc(&seen);
+
+    // flipping any bit changes about half of the output bits
+    U64 h = hash_bytes_64(buf, 100);
+    U32 flipped = 0;
+    for (U32 i = 0; i < 100 * 8; ++i) {
+        buf[i / 8] ^= (U8)(1 << (i % 8));
+        flipped += (U32)__builtin_popcountll(h ^ hash_bytes_64(buf, 100));
+        buf[i / 8] ^= (U8)(1 << (i % 8));
+    }
+    F32 avg = (F32)flipped / (100 * 8);
+    assert(avg > 30.0f && avg < 34.0f);
+
+    printf("%fus\n", timer_elapsed_us(&timer));
+
+    return 0;
+}
+
+int test_hash_state(void) {
+    Timer timer = timer_start();
+
+    U8 buf[300];
+    for (U32 i = 0; i < sizeof(buf); ++i) { buf[i] = (U8)(i * 13 + 5); }
+
+    // feed every length in pieces of each size, including ones that end exactly on a block
+    for (U64 len = 0; len <= sizeof(buf); ++len) {
+        U32 expected = hash_bytes(buf, len);
+        U64 expected_64 = hash_bytes_64_seed(buf, len, 7);
+        for (U64 piece = 1; piece <= 100; piece += (piece < 20 ? 1 : 29)) {
+            HashState state = hash_state_init();
+            HashState64 state_64 = hash_state_64_init(7);
+            for (U64 i = 0; i < len; i += piece) {
+                U64 n = len - i < piece ? len - i : piece;
+                hash_state_update(&state, buf + i, n);
+                hash_state_64_update(&state_64, buf + i, n);
+            }
+            assert(hash_state_finish(&state) == expected);
+            assert(hash_state_64_finish(&state_64) == expected_64);
+        }
+    }
+
+    printf("%fus\n", timer_elapsed_us(&timer));
+
+    return 0;
+}
+
+int test_hash_batch(void) {
+    Timer timer = timer_start();
+
+    // the fixed size paths match hash_bytes
+    U32 a = 0x12345678;
+    U64 b = 0x123456789abcdef0;
+    U32 c[4] = { 1, 2, 3, 4 };
+    assert(hash_bytes_4(&a) == hash_bytes((U8*)&a, sizeof(a)));
+    assert(hash_bytes_8(&b) == hash_bytes((U8*)&b, sizeof(b)));
+    assert(hash_bytes_16(c) == hash_bytes((U8*)c, sizeof(c)));
+#ifndef HASH_KEY_64
+    U8 d[5] = { 1, 2, 3, 4, 5 };
+    assert(HASH(d) == hash_bytes(d, sizeof(d)));
+#endif
+
+    // lengths that leave a remainder for the scalar loop
+    U32 keys_32[100];
+    U64 keys_64[100];
+    HashKey out_32[100];
+    HashKey out_64[100];
+    Prng p = prng_create(0);
+    for (U32 i = 0; i < 100; ++i) {
+        keys_32[i] = prng_next(&p);
+        keys_64[i] = ((U64)prng_next(&p) << 32) | prng_next(&p);
+    }
+
+    for (U64 n = 0; n <= 100; n += 7) {
+        memset(out_32, 0, sizeof(out_32));
+        memset(out_64, 0, sizeof(out_64));
+        hash_u32_batch(keys_32, out_32, n);
+        hash_u64_batch(keys_64, out_64, n);
+        for (U64 i = 0; i < n; ++i) {
+            assert(out_32[i] == HASH(keys_32[i]));
+            assert(out_64[i] == HASH(keys_64[i]));
+        }
+        for (U64 i = n; i < 100; ++i) { assert(out_32[i] == 0 && out_64[i] == 0); }
+    }
+
+    printf("%fus\n", timer_elapsed_us(&timer));
+
+    return 0;
+}
+
 int test_set(void) {
     Timer timer = timer_start();
     Set set = set_create(4096);
@@ -87,6 +398,211 @@ int test_set(void) {
     return 0;
 }
 
+int test_set_grow(void) {
+    Timer timer = timer_start();
+    Set set = set_create(16);
+    GroupSet group = group_set_create(16);
+
+    for (U32 i = 0; i < 100000; ++i) {
+        set_insert(&set, HASH(i));
+        group_set_insert(&group, HASH(i));
+    }
+
+    assert(set.count == 100000);
+    assert(group.count == 100000);
+
+    for (U32 i = 0; i < 100000; ++i) {
+        assert((set_lookup(&set, HASH(i)) & 1) == 1);
+        assert((group_set_lookup(&group, HASH(i)) & 1) == 1);
+    }
+
+    set_dealloc(&set);
+    group_set_dealloc(&group);
+
+    // churn through a small working set, tombstones must not grow the table
+    set = set_create(64);
+    group = group_set_create(64);
+    U32 mask = set.mask;
+    U32 group_mask = group.mask;
+
+    for (U32 i = 0; i < 100000; ++i) {
+        set_insert(&set, HASH(i));
+        group_set_insert(&group, HASH(i));
+        if (i >= 32) {
+            U32 old = i - 32;
+            assert((set_remove(&set, HASH(old)) & 1) == 1);
+            assert((group_set_remove(&group, HASH(old)) & 1) == 1);
+        }
+    }
+
+    assert(set.count == 32 && set.mask == mask);
+    assert(group.count == 32 && group.mask == group_mask);
+
+    set_dealloc(&set);
+    group_set_dealloc(&group);
+
+    // re-inserting present keys at the load limit keeps the table and indices
+    set = set_create(64);
+    group = group_set_create(64);
+    for (U32 i = 0; set.count < set.grow_at; ++i) { set_insert(&set, HASH(i)); }
+    for (U32 i = 0; group.count < group.grow_at; ++i) { group_set_insert(&group, HASH(i)); }
+    U32 first = 0;
+    mask = set.mask;
+    group_mask = group.mask;
+    U32 idx = set_insert(&set, HASH(first));
+    U32 group_idx = group_set_insert(&group, HASH(first));
+    assert(set.mask == mask && idx == set_lookup(&set, HASH(first)) >> 32);
+    assert(group.mask == group_mask && group_idx == group_set_lookup(&group, HASH(first)) >> 32);
+    U32 fresh = 1000000;
+    set_insert(&set, HASH(fresh));
+    group_set_insert(&group, HASH(fresh));
+    assert(set.mask > mask && group.mask > group_mask);
+
+    set_dealloc(&set);
+    group_set_dealloc(&group);
+
+    printf("%fus\n", timer_elapsed_us(&timer));
+
+    return 0;
+}
+
+int test_set_shift(void) {
+    Timer timer = timer_start();
+    Set set = set_create(1024);
+    U32 mask = set.mask;
+
+    // keep 512 keys live while churning through many more
+    for (U32 i = 0; i < 200000; ++i) {
+        set_insert(&set, HASH(i));
+        if (i >= 512) {
+            U32 old = i - 512;
+            assert((set_remove_shift(&set, HASH(old), NULL, 0) & 1) == 1);
+            assert((set_lookup(&set, HASH(old)) & 1) == 0);
+        }
+    }
+
+    assert(set.count == 512 && set.tombstones == 0 && set.mask == mask);
+
+    for (U32 i = 200000 - 512; i < 200000; ++i) {
+        assert((set_lookup(&set, HASH(i)) & 1) == 1);
+    }
+
+    set_dealloc(&set);
+
+    printf("%fus\n", timer_elapsed_us(&timer));
+
+    return 0;
+}
+
+int test_set_stats(void) {
+    Timer timer = timer_start();
+    Set set = set_create(4096);
+
+    for (U32 i = 0; i < 3000; ++i) {
+        set_insert(&set, HASH(i));
+    }
+
+    SetStats stats = set_stats(&set);
+    assert(stats.count == 3000 && stats.slots == set.mask + 1);
+    assert(stats.avg_probe >= 1.0f && stats.max_probe >= 1);
+    assert(stats.max_cluster >= stats.max_probe);
+    assert(!stats.clustered);
+
+    U32 histogram_count = 0;
+    for (U32 i = 0; i < SET_PROBE_HISTOGRAM; ++i) { histogram_count += stats.histogram[i]; }
+    assert(histogram_count == 3000);
+
+    // inline buckets probe the same way, so the same keys give the same stats
+    Map_U16 inline_map = map_create_U16(4096);
+    for (U32 i = 0; i < 3000; ++i) {
+        map_insert_U16(&inline_map, HASH(i), (U16)i);
+    }
+    SetStats inline_stats = map_stats_U16(&inline_map);
+    assert(inline_stats.slots == stats.slots && inline_stats.count == 3000);
+    assert(inline_stats.max_probe == stats.max_probe && inline_stats.max_cluster == stats.max_cluster);
+    assert(inline_stats.avg_probe == stats.avg_probe);
+    map_dealloc_U16(&inline_map);
+
+    set_dealloc(&set);
+
+    // low bits are all the same, so every key starts probing at slot 0
+    set = set_create(4096);
+    for (U32 i = 1; i <= 1000; ++i) {
+        set_insert(&set, i << 20);
+    }
+
+    stats = set_stats(&set);
+    assert(stats.max_probe == 1000 && stats.max_cluster == 1000);
+    assert(stats.clustered);
+
+    set_dealloc(&set);
+
+    GroupSet group_set = group_set_create(4096);
+    for (U32 i = 0; i < 3000; ++i) {
+        group_set_insert(&group_set, HASH(i));
+    }
+
+    stats = group_set_stats(&group_set);
+    assert(stats.count == 3000 && stats.avg_probe >= 1.0f);
+    assert(!stats.clustered);
+
+    group_set_dealloc(&group_set);
+
+    printf("%fus\n", timer_elapsed_us(&timer));
+
+    return 0;
+}
+
+int test_group_set(void) {
+    Timer timer = timer_start();
+    GroupSet set = group_set_create(4096);
+
+    Prng p = prng_create(0);
+
+    for (U64 i = 0; i < 3072; ++i) {
+        U32 r = prng_next(&p);
+        group_set_insert(&set, HASH(r));
+    }
+
+    p = prng_create(0);
+
+    for (U64 i = 0; i < 3072; ++i) {
+        U32 r = prng_next(&p);
+        assert((group_set_lookup(&set, HASH(r)) & 1) == 1);
+    }
+
+    for (U64 i = 0; i < 256; ++i) {
+        U32 r = prng_next(&p);
+        assert((group_set_lookup(&set, HASH(r)) & 1) == 0);
+    }
+
+    p = prng_create(0);
+
+    for (U64 i = 0; i < 3072; ++i) {
+        U32 r = prng_next(&p);
+        assert((group_set_remove(&set, HASH(r)) & 1) == 1);
+    }
+
+    p = prng_create(0);
+
+    for (U64 i = 0; i < 3072; ++i) {
+        U32 r = prng_next(&p);
+        assert((group_set_lookup(&set, HASH(r)) & 1) == 0);
+    }
+
+    // reuses deleted slots
+    for (U64 i = 0; i < 3072; ++i) {
+        U32 r = prng_next(&p);
+        group_set_insert(&set, HASH(r));
+    }
+
+    group_set_dealloc(&set);
+
+    printf("%fus\n", timer_elapsed_us(&timer));
+
+    return 0;
+}
+
 int test_map(void) {
     Timer timer = timer_start();
     Map_U32 map = map_create_U32(4096);
@@ -129,56 +645,476 @@ int test_map(void) {
     return 0;
 }
 
-int test_stack(void) {
-    Stack_U32 s = stack_create_U32(0);
-    Prng p = prng_create(0);
+int test_map_grow(void) {
+    Timer timer = timer_start();
+    Map_U32 map = map_create_U32(4);
+    Map_U64 group_map = map_create_U64(4);
 
-    Timer t = timer_start();
+    for (U32 i = 0; i < 100000; ++i) {
+        map_insert_U32(&map, HASH(i), i);
+        map_insert_U64(&group_map, HASH(i), (U64)i * 3);
+    }
 
-    for (U64 i = 0; i < 1024; ++i) {
-        U32 r = prng_next(&p);
-        stack_push_U32(&s, r);
+    for (U32 i = 0; i < 100000; ++i) {
+        assert(*map_lookup_U32(&map, HASH(i)) == i);
+        assert(*map_lookup_U64(&group_map, HASH(i)) == (U64)i * 3);
     }
 
-    p = prng_create(0);
+    map_dealloc_U32(&map);
+    map_dealloc_U64(&group_map);
 
-    for (U64 i = 0; i < 1024; ++i) {
-        U32 r = prng_next(&p);
-        assert(s.objects[i] == r);
+    printf("%fus\n", timer_elapsed_us(&timer));
+
+    return 0;
+}
+
+int test_map_incremental(void) {
+    Timer timer = timer_start();
+
+    // a key removed after it was migrated stays removed while the migration goes on
+    Map_I64 migrating = map_create_I64(4);
+    U32 inserted = 0;
+    U32 before_grow = 0;
+    while (migrating.old_set.keys == NULL || migrating.migrate_pos == 0) {
+        if (migrating.old_set.keys == NULL) { before_grow = inserted; }
+        map_insert_I64(&migrating, HASH(inserted), 17);
+        inserted += 1;
     }
+    U32 migrated = 0;
+    while (migrated < before_grow && (set_lookup(&migrating.set, HASH(migrated)) & 1) == 0) { migrated += 1; }
+    assert(migrated < before_grow);
+    assert(map_remove_I64(&migrating, HASH(migrated)) != NULL);
+    assert(migrating.old_set.keys != NULL);
+    assert(map_lookup_I64(&migrating, HASH(migrated)) == NULL);
+    map_dealloc_I64(&migrating);
 
-    for (U64 i = 0; i < 1024; ++i) {
-        stack_pop_U32(&s);
+    Map_I64 map = map_create_I64(4);
+
+    for (U32 i = 0; i < 100000; ++i) {
+        map_insert_I64(&map, HASH(i), i);
+
+        if (i % 3 == 0) { map_insert_I64(&map, HASH(i), -(I64)i); }
+        if (i % 5 == 0) { assert(map_remove_I64(&map, HASH(i)) != NULL); }
+
+        // older keys are likely still in the old table
+        U32 old = i / 2;
+        if (old % 5 != 0 && old % 7 != 0) {
+            I64 expected = old % 3 == 0 ? -(I64)old : old;
+            assert(*map_lookup_I64(&map, HASH(old)) == expected);
+        }
+        if (i % 2 == 0 && old % 7 == 0 && old % 5 != 0) {
+            assert(map_remove_I64(&map, HASH(old)) != NULL);
+        }
     }
 
-    assert(s.len == 0);
+    for (U32 i = 0; i < 100000; ++i) {
+        I64* v = map_lookup_I64(&map, HASH(i));
+        if (i % 5 == 0 || (i % 7 == 0 && i < 50000)) {
+            assert(v == NULL);
+        } else if (i % 3 == 0) {
+            assert(*v == -(I64)i);
+        } else {
+            assert(*v == i);
+        }
+    }
 
-    printf("%f\n", timer_elapsed_us(&t));
+    map_dealloc_I64(&map);
+
+    printf("%fus\n", timer_elapsed_us(&timer));
 
     return 0;
 }
 
-//int test_arena(void) {
-//    Timer t = timer_start();
-//    ArenaTracking ar = arena_tracking_create();
-//    ArenaKey* arena_tracking_elements = vm_alloc(ARENA_MAX_ELEMENTS * sizeof(*arena_tracking_elements));
-//    printf("%f\n", timer_elapsed_us(&t));
-//
-//    U64 n = 256;
-//
-//    for (U64 i = 0; i < n; ++i) {
-//        U64 idx = arena_tracking_insert(&ar);
-//        arena_tracking_elements[idx] = i;
-//        //printf("insert at %u\n", arena_tracking_insert(&ar));
-//    }
-//
-//    for (U64 i = 0; i < n; i += 2) {
-//        arena_tracking_remove(&ar,(ArenaIdx)i);
-//        //printf("remove at %u\n", i);
-//    }
-//
-//    for (U64 i = 0; i < n; i += 4) {
-//        U64 idx = arena_tracking_insert(&ar);
+int test_map_shift(void) {
+    Timer timer = timer_start();
+    Map_F64 map = map_create_F64(1024);
+
+    for (U32 i = 0; i < 100000; ++i) {
+        map_insert_F64(&map, HASH(i), (F64)i);
+        if (i >= 512) {
+            U32 old = i - 512;
+            assert(*map_remove_F64(&map, HASH(old)) == (F64)old);
+        }
+    }
+
+    for (U32 i = 0; i < 100000 - 512; ++i) {
+        assert(map_lookup_F64(&map, HASH(i)) == NULL);
+    }
+
+    for (U32 i = 100000 - 512; i < 100000; ++i) {
+        assert(*map_lookup_F64(&map, HASH(i)) == (F64)i);
+    }
+
+    map_dealloc_F64(&map);
+
+    printf("%fus\n", timer_elapsed_us(&timer));
+
+    return 0;
+}
+
+int test_map_inline(void) {
+    Timer timer = timer_start();
+    Map_U16 map = map_create_U16(4);
+
+    for (U32 i = 0; i < 100000; ++i) {
+        map_insert_U16(&map, HASH(i), (U16)i);
+    }
+
+    for (U32 i = 0; i < 100000; i += 3) {
+        map_insert_U16(&map, HASH(i), (U16)(i + 1));
+    }
+
+    assert(map.count == 100000);
+
+    for (U32 i = 0; i < 100000; i += 2) {
+        U16 expected = (U16)(i % 3 == 0 ? i + 1 : i);
+        assert(*map_remove_U16(&map, HASH(i)) == expected);
+    }
+
+    static HashKey keys[100000];
+    static U16* objects[100000];
+    for (U32 i = 0; i < 100000; ++i) { keys[i] = HASH(i); }
+    map_lookup_batch_U16(&map, keys, objects, 100000);
+
+    for (U32 i = 0; i < 100000; ++i) {
+        U16* v = map_lookup_U16(&map, HASH(i));
+        assert(v == objects[i]);
+        if (i % 2 == 0) {
+            assert(v == NULL);
+        } else {
+            assert(*v == (U16)(i % 3 == 0 ? i + 1 : i));
+        }
+    }
+
+    map_dealloc_U16(&map);
+
+    printf("%fus\n", timer_elapsed_us(&timer));
+
+    return 0;
+}
+
+int test_map_snapshot(void) {
+    Timer timer = timer_start();
+    const char* path = "/tmp/tools_test_map_snapshot";
+
+    Map_U32 map = map_create_U32(16);
+    for (U32 i = 0; i < 10000; ++i) {
+        map_insert_U32(&map, HASH(i), i * 3);
+    }
+    for (U32 i = 0; i < 10000; i += 4) {
+        map_remove_U32(&map, HASH(i));
+    }
+
+    assert(map_save_U32(&map, path) == 0);
+
+    Map_U32 opened;
+    assert(map_open_mmap_U32(&opened, path) == 0);
+    assert(opened.set.count == map.set.count);
+
+    for (U32 i = 0; i < 20000; ++i) {
+        U32* v = map_lookup_U32(&opened, HASH(i));
+        if (i >= 10000 || i % 4 == 0) {
+            assert(v == NULL);
+        } else {
+            assert(*v == i * 3);
+        }
+    }
+
+    // different object size
+    Map_F64 wrong;
+    assert(map_open_mmap_F64(&wrong, path) == 1);
+
+    map_close_mmap_U32(&opened);
+    map_dealloc_U32(&map);
+    unlink(path);
+
+    assert(map_open_mmap_U32(&opened, path) == 1);
+
+    printf("%fus\n", timer_elapsed_us(&timer));
+
+    return 0;
+}
+
+int test_group_map(void) {
+    Timer timer = timer_start();
+    Map_U64 map = map_create_U64(4096);
+
+    Prng p = prng_create(0);
+
+    for (U64 i = 0; i < 256; ++i) {
+        U64 r = prng_next(&p);
+        map_insert_U64(&map, HASH(r), r);
+    }
+
+    p = prng_create(0);
+
+    for (U64 i = 0; i < 256; ++i) {
+        U64 r = prng_next(&p);
+        assert(*map_lookup_U64(&map, HASH(r)) == r);
+    }
+
+    for (U64 i = 0; i < 256; ++i) {
+        U64 r = prng_next(&p);
+        assert(map_lookup_U64(&map, HASH(r)) == NULL);
+    }
+
+    p = prng_create(0);
+
+    for (U64 i = 0; i < 256; ++i) {
+        U64 r = prng_next(&p);
+        assert(*map_remove_U64(&map, HASH(r)) == r);
+    }
+
+    for (U64 i = 0; i < 256; ++i) {
+        U64 r = prng_next(&p);
+        assert(map_lookup_U64(&map, HASH(r)) == NULL);
+    }
+
+    map_dealloc_U64(&map);
+
+    printf("%fus\n", timer_elapsed_us(&timer));
+
+    return 0;
+}
+
+int test_key_map(void) {
+    Timer timer = timer_start();
+
+    static char names[4096][16];
+    KeyMap_String_U32 map = key_map_create_String_U32(16);
+
+    for (U32 i = 0; i < 4096; ++i) {
+        snprintf(names[i], sizeof(names[i]), "key %u", i);
+        key_map_insert_String_U32(&map, string_create(names[i]), i);
+    }
+
+    for (U32 i = 0; i < 4096; ++i) {
+        // separate copy of the key, looked up by value
+        char name[16];
+        snprintf(name, sizeof(name), "key %u", i);
+        assert(*key_map_lookup_String_U32(&map, string_create(name)) == i);
+    }
+
+    char missing[] = "key 4096";
+    assert(key_map_lookup_String_U32(&map, string_create(missing)) == NULL);
+
+    for (U32 i = 0; i < 4096; i += 2) {
+        assert(*key_map_remove_String_U32(&map, string_create(names[i])) == i);
+    }
+
+    for (U32 i = 0; i < 4096; ++i) {
+        U32* v = key_map_lookup_String_U32(&map, string_create(names[i]));
+        assert(i % 2 == 0 ? v == NULL : *v == i);
+    }
+
+    key_map_dealloc_String_U32(&map);
+
+    KeyMap_U64_U64 colliding = key_map_create_U64_U64(16);
+
+    for (U64 i = 0; i < 1024; ++i) {
+        key_map_insert_U64_U64(&colliding, i, i * 2);
+    }
+
+    // overwrites
+    for (U64 i = 0; i < 1024; i += 3) {
+        key_map_insert_U64_U64(&colliding, i, i * 5);
+    }
+
+    assert(colliding.count == 1024);
+
+    for (U64 i = 0; i < 1024; ++i) {
+        U64 expected = i % 3 == 0 ? i * 5 : i * 2;
+        assert(*key_map_lookup_U64_U64(&colliding, i) == expected);
+    }
+
+    assert(key_map_lookup_U64_U64(&colliding, 1024) == NULL);
+
+    key_map_dealloc_U64_U64(&colliding);
+
+    printf("%fus\n", timer_elapsed_us(&timer));
+
+    return 0;
+}
+
+int test_lookup_batch(void) {
+    Timer timer = timer_start();
+
+    static HashKey keys[3000];
+    static U64 found[3000];
+    static U64 group_found[3000];
+
+    Set set = set_create(16);
+    GroupSet group = group_set_create(16);
+    Map_U32 map = map_create_U32(16);
+    Map_I64 inc = map_create_I64(16);
+    for (U32 i = 0; i < 2000; ++i) {
+        set_insert(&set, HASH(i));
+        group_set_insert(&group, HASH(i));
+        map_insert_U32(&map, HASH(i), i);
+        map_insert_I64(&inc, HASH(i), i);
+    }
+
+    // half hits, half misses
+    for (U32 i = 0; i < 3000; ++i) {
+        U32 k = i * 2 / 3 + (i % 3 == 0 ? 2000 : 0);
+        keys[i] = HASH(k);
+    }
+
+    set_lookup_batch(&set, keys, found, 3000);
+    group_set_lookup_batch(&group, keys, group_found, 3000);
+    for (U32 i = 0; i < 3000; ++i) {
+        assert(found[i] == set_lookup(&set, keys[i]));
+        assert(group_found[i] == group_set_lookup(&group, keys[i]));
+    }
+
+    static U32* objects[3000];
+    static I64* inc_objects[3000];
+    map_lookup_batch_U32(&map, keys, objects, 3000);
+    map_lookup_batch_I64(&inc, keys, inc_objects, 3000);
+    // lookups don't migrate, so pointers into either table stay put
+    assert(inc.old_set.keys != NULL);
+    for (U32 i = 0; i < 3000; ++i) {
+        assert(objects[i] == map_lookup_U32(&map, keys[i]));
+        assert(inc_objects[i] == map_lookup_I64(&inc, keys[i]));
+    }
+
+    set_dealloc(&set);
+    group_set_dealloc(&group);
+    map_dealloc_U32(&map);
+    map_dealloc_I64(&inc);
+
+    static U64 key_map_keys[3000];
+    static U64* values[3000];
+    KeyMap_U64_U64 key_map = key_map_create_U64_U64(16);
+    for (U64 i = 0; i < 2000; ++i) {
+        key_map_insert_U64_U64(&key_map, i, i * 2);
+    }
+    for (U64 i = 0; i < 3000; ++i) {
+        key_map_keys[i] = i * 7 % 3000;
+    }
+
+    key_map_lookup_batch_U64_U64(&key_map, key_map_keys, values, 3000);
+    for (U64 i = 0; i < 3000; ++i) {
+        assert(values[i] == key_map_lookup_U64_U64(&key_map, key_map_keys[i]));
+    }
+
+    key_map_dealloc_U64_U64(&key_map);
+
+    printf("%fus\n", timer_elapsed_us(&timer));
+
+    return 0;
+}
+
+#define CONCURRENT_THREADS 4
+#define CONCURRENT_KEYS 50000
+
+typedef struct {
+    ConcurrentMap_U32* map;
+    U32 thread;
+} ConcurrentTestArgs;
+
+static void* test_concurrent_thread(void* ptr) {
+    ConcurrentTestArgs* args = ptr;
+    ConcurrentMap_U32* map = args->map;
+    U32 start = args->thread * CONCURRENT_KEYS;
+
+    for (U32 i = start; i < start + CONCURRENT_KEYS; ++i) {
+        assert(concurrent_map_insert_U32(map, HASH(i), i));
+        assert(*concurrent_map_lookup_U32(map, HASH(i)) == i);
+
+        // keys of other threads are either missing or complete
+        U32 other = (i * 7) % (CONCURRENT_THREADS * CONCURRENT_KEYS);
+        const U32* v = concurrent_map_lookup_U32(map, HASH(other));
+        assert(v == NULL || *v == other);
+    }
+
+    for (U32 i = start; i < start + CONCURRENT_KEYS; i += 2) {
+        assert(concurrent_map_remove_U32(map, HASH(i)));
+        assert(!concurrent_map_remove_U32(map, HASH(i)));
+    }
+
+    return NULL;
+}
+
+int test_concurrent(void) {
+    Timer timer = timer_start();
+    ConcurrentMap_U32 map = concurrent_map_create_U32(16);
+
+    pthread_t threads[CONCURRENT_THREADS];
+    ConcurrentTestArgs args[CONCURRENT_THREADS];
+    for (U32 t = 0; t < CONCURRENT_THREADS; ++t) {
+        args[t] = (ConcurrentTestArgs) { .map = &map, .thread = t };
+        pthread_create(&threads[t], NULL, test_concurrent_thread, &args[t]);
+    }
+    for (U32 t = 0; t < CONCURRENT_THREADS; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+
+    concurrent_map_reclaim_U32(&map);
+
+    for (U32 i = 0; i < CONCURRENT_THREADS * CONCURRENT_KEYS; ++i) {
+        const U32* v = concurrent_map_lookup_U32(&map, HASH(i));
+        assert(i % 2 == 0 ? v == NULL : *v == i);
+        assert(concurrent_map_insert_U32(&map, HASH(i), i) == (i % 2 == 0));
+    }
+
+    concurrent_map_dealloc_U32(&map);
+
+    printf("%fus\n", timer_elapsed_us(&timer));
+
+    return 0;
+}
+
+int test_stack(void) {
+    Stack_U32 s = stack_create_U32(0);
+    Prng p = prng_create(0);
+
+    Timer t = timer_start();
+
+    for (U64 i = 0; i < 1024; ++i) {
+        U32 r = prng_next(&p);
+        stack_push_U32(&s, r);
+    }
+
+    p = prng_create(0);
+
+    for (U64 i = 0; i < 1024; ++i) {
+        U32 r = prng_next(&p);
+        assert(s.objects[i] == r);
+    }
+
+    for (U64 i = 0; i < 1024; ++i) {
+        stack_pop_U32(&s);
+    }
+
+    assert(s.len == 0);
+
+    printf("%f\n", timer_elapsed_us(&t));
+
+    return 0;
+}
+
+//int test_arena(void) {
+//    Timer t = timer_start();
+//    ArenaTracking ar = arena_tracking_create();
+//    ArenaKey* arena_tracking_elements = vm_alloc(ARENA_MAX_ELEMENTS * sizeof(*arena_tracking_elements));
+//    printf("%f\n", timer_elapsed_us(&t));
+//
+//    U64 n = 256;
+//
+//    for (U64 i = 0; i < n; ++i) {
+//        U64 idx = arena_tracking_insert(&ar);
+//        arena_tracking_elements[idx] = i;
+//        //printf("insert at %u\n", arena_tracking_insert(&ar));
+//    }
+//
+//    for (U64 i = 0; i < n; i += 2) {
+//        arena_tracking_remove(&ar,(ArenaIdx)i);
+//        //printf("remove at %u\n", i);
+//    }
+//
+//    for (U64 i = 0; i < n; i += 4) {
+//        U64 idx = arena_tracking_insert(&ar);
 //        arena_tracking_elements[idx] = i;
 //        //printf("insert at %u\n", arena_tracking_insert(&ar));
 //    }
@@ -207,6 +1143,512 @@ int test_stack(void) {
 //    return 0;
 //}
 
+int test_arena_tracking(void) {
+    Timer t = timer_start();
+    ArenaTracking ar = arena_tracking_create();
+
+    U32 n = 20000;
+    ArenaKey* keys = malloc(n * sizeof(ArenaKey));
+    for (U32 i = 0; i < n; ++i) {
+        keys[i] = arena_tracking_insert(&ar);
+        assert(keys[i].idx == i);
+    }
+
+    // spread over many words and summary words
+    for (U32 i = 0; i < n; i += 3) {
+        arena_tracking_remove(&ar, keys[i]);
+        assert(!arena_tracking_key_valid(&ar, keys[i]));
+    }
+
+    for (U32 w = 0; w < (n + 63) / 64; ++w) {
+        bool summary = (ar.free_summary[w / 64] >> (w % 64)) & 1;
+        assert(summary == (ar.free[w] != 0));
+    }
+
+    // lowest free slot first, then appends once none are left
+    for (U32 i = 0; i < n; i += 3) {
+        keys[i] = arena_tracking_insert(&ar);
+        assert(keys[i].idx == i);
+    }
+    assert(ar.free_top[0] == 0);
+    assert(arena_tracking_insert(&ar).idx == n);
+
+    for (U32 i = 0; i < n; ++i) { assert(arena_tracking_key_valid(&ar, keys[i])); }
+
+    free(keys);
+    arena_tracking_dealloc(&ar);
+
+    // unmapping the generations makes every commit fail, inserts must not claim a slot
+    Usize size = arena_tracking_size();
+    U8* mem = vm_reserve(size);
+    ar = arena_tracking_create_at(mem);
+    assert(ar.free != NULL);
+    Usize kept = (Usize)((U8*)ar.generations - mem);
+    vm_dealloc(ar.generations, size - kept);
+    assert(arena_tracking_insert(&ar).idx == ARENA_INVALID_IDX);
+    assert(arena_tracking_insert_atomic(&ar).idx == ARENA_INVALID_IDX);
+    assert(ar.element_num == 0 && ar.committed == 0);
+    vm_dealloc(mem, kept);
+
+    printf("%fus\n", timer_elapsed_us(&t));
+
+    return 0;
+}
+
+static void test_arena_add(U64* e, void* ctx) {
+    *(U64*)ctx += *e;
+}
+
+int test_arena_iter(void) {
+    Timer t = timer_start();
+    Arena_U64 ar = arena_create_U64();
+
+    // the removed runs cover whole words and the last partial word
+    U64 n = 1000;
+    ArenaKey* keys = malloc(n * sizeof(ArenaKey));
+    for (U64 i = 0; i < n; ++i) { keys[i] = arena_insert_U64(&ar, i); }
+    U64 expected = 0;
+    U64 count = 0;
+    for (U64 i = 0; i < n; ++i) {
+        if (i % 7 == 0 || (i >= 128 && i < 320) || i >= 990) {
+            arena_remove_U64(&ar, keys[i]);
+        } else {
+            expected += i;
+            count += 1;
+        }
+    }
+
+    U64 sum = 0;
+    U64 seen = 0;
+    ArenaIter iter = arena_iter(&ar.tracking);
+    U32 last = 0;
+    while (true) {
+        ArenaKey k = arena_iter_next(&iter);
+        if (k.idx == ARENA_INVALID_IDX) { break; }
+        assert(seen == 0 || k.idx > last);
+        assert(arena_key_equal(k, keys[k.idx]));
+        last = k.idx;
+        sum += *arena_lookup_U64(&ar, k);
+        seen += 1;
+    }
+    assert(sum == expected && seen == count);
+    assert(arena_iter_next(&iter).idx == ARENA_INVALID_IDX);
+
+    sum = 0;
+    seen = 0;
+    ARENA_FOREACH(&ar, e) {
+        sum += *e;
+        seen += 1;
+    }
+    assert(sum == expected && seen == count);
+
+    // break and continue act on the whole loop
+    seen = 0;
+    ARENA_FOREACH(&ar, e) {
+        if (seen == 3) { break; }
+        assert(*e < n);
+        seen += 1;
+    }
+    assert(seen == 3);
+    U64 skipped = 0;
+    seen = 0;
+    ARENA_FOREACH(&ar, e) {
+        if (*e % 2 == 1) { skipped += 1; continue; }
+        seen += 1;
+    }
+    assert(seen + skipped == count && skipped > 0 && seen > 0);
+
+    sum = 0;
+    arena_visit_U64(&ar, test_arena_add, &sum);
+    assert(sum == expected);
+
+    free(keys);
+    arena_dealloc_U64(&ar);
+
+    printf("%fus\n", timer_elapsed_us(&t));
+
+    return 0;
+}
+
+int test_arena_grow(void) {
+    Timer t = timer_start();
+    Arena_U64 ar = arena_create_U64();
+
+    // only the first chunk is committed for a small arena
+    for (U64 i = 0; i < 10; ++i) { arena_insert_U64(&ar, i); }
+    assert(ar.tracking.committed == ARENA_COMMIT_MIN && ar.committed == ARENA_COMMIT_MIN);
+
+    // more than 16 bit handles can address with ARENA_HANDLE_32
+    U64 n = ARENA_MAX_ELEMENTS - 1 < 300000 ? ARENA_MAX_ELEMENTS - 1 : 300000;
+    for (U64 i = 10; i < n; ++i) {
+        ArenaKey k = arena_insert_U64(&ar, i);
+        assert(k.idx == i);
+    }
+    assert(ar.tracking.committed >= n && ar.committed >= n);
+
+    for (U64 i = 0; i < n; i += 1000) {
+        ArenaKey k = { .idx = (ArenaIdx)i, .gen = ar.tracking.generations[i] };
+        assert(*arena_lookup_U64(&ar, k) == i);
+    }
+
+    arena_tracking_reset(&ar.tracking);
+    assert(ar.tracking.element_num == 0 && arena_tracking_insert(&ar.tracking).idx == 0);
+
+    arena_dealloc_U64(&ar);
+
+    printf("%fus\n", timer_elapsed_us(&t));
+
+    return 0;
+}
+
+int test_slot_map(void) {
+    Timer t = timer_start();
+    SlotMap_U64 map = slot_map_create_U64();
+
+    U64 n = 5000;
+    ArenaKey* keys = malloc(n * sizeof(ArenaKey));
+    for (U64 i = 0; i < n; ++i) { keys[i] = slot_map_insert_U64(&map, i); }
+
+    // removing from the middle, the front and the back all move values
+    U64 expected = 0;
+    U64 count = 0;
+    for (U64 i = 0; i < n; ++i) {
+        if (i % 3 == 0 || i < 10 || i >= n - 10) {
+            slot_map_remove_U64(&map, keys[i]);
+        } else {
+            expected += i;
+            count += 1;
+        }
+    }
+    assert(map.len == count);
+
+    U64 sum = 0;
+    for (U32 i = 0; i < map.len; ++i) {
+        sum += map.values[i];
+        ArenaKey k = slot_map_key_U64(&map, i);
+        assert(arena_key_equal(k, keys[map.values[i]]));
+    }
+    assert(sum == expected);
+
+    for (U64 i = 0; i < n; ++i) {
+        U64* v = slot_map_lookup_U64(&map, keys[i]);
+        if (i % 3 == 0 || i < 10 || i >= n - 10) {
+            assert(v == NULL);
+        } else {
+            assert(v != NULL && *v == i);
+        }
+    }
+
+    // removed slots are reused with a new generation
+    ArenaKey k = slot_map_insert_U64(&map, 12345);
+    assert(k.idx == keys[0].idx && k.gen != keys[0].gen);
+    assert(*slot_map_lookup_U64(&map, k) == 12345);
+    assert(slot_map_lookup_U64(&map, keys[0]) == NULL);
+
+    free(keys);
+    slot_map_dealloc_U64(&map);
+
+    printf("%fus\n", timer_elapsed_us(&t));
+
+    return 0;
+}
+
+#define TEST_ARENA_THREADS 4
+#define TEST_ARENA_KEYS 3000
+
+typedef struct {
+    Arena_U64* ar;
+    U64 thread;
+    int failed;
+} TestArenaThread;
+
+static void* test_arena_atomic_thread(void* ptr) {
+    TestArenaThread* arg = ptr;
+    ArenaKey* keys = malloc(TEST_ARENA_KEYS * sizeof(ArenaKey));
+
+    for (U64 round = 0; round < 20; ++round) {
+        for (U64 i = 0; i < TEST_ARENA_KEYS; ++i) {
+            keys[i] = arena_insert_atomic_U64(arg->ar, (arg->thread << 32) | i);
+        }
+
+        // a slot claimed by two threads would hold the other thread's value
+        for (U64 i = 0; i < TEST_ARENA_KEYS; ++i) {
+            U64 v;
+            if (!arena_read_atomic_U64(arg->ar, keys[i], &v) || v != ((arg->thread << 32) | i)) { arg->failed = 1; }
+        }
+
+        for (U64 i = 0; i < TEST_ARENA_KEYS; ++i) {
+            if (!arena_remove_atomic_U64(arg->ar, keys[i])) { arg->failed = 1; }
+            if (arena_remove_atomic_U64(arg->ar, keys[i])) { arg->failed = 1; }
+        }
+    }
+
+    free(keys);
+    return NULL;
+}
+
+int test_arena_atomic(void) {
+    Timer t = timer_start();
+    Arena_U64 ar = arena_create_U64();
+
+    pthread_t threads[TEST_ARENA_THREADS];
+    TestArenaThread args[TEST_ARENA_THREADS];
+    for (U64 i = 0; i < TEST_ARENA_THREADS; ++i) {
+        args[i] = (TestArenaThread) { .ar = &ar, .thread = i, .failed = 0 };
+        pthread_create(&threads[i], NULL, test_arena_atomic_thread, &args[i]);
+    }
+    for (U64 i = 0; i < TEST_ARENA_THREADS; ++i) {
+        pthread_join(threads[i], NULL);
+        assert(args[i].failed == 0);
+    }
+
+    // everything was removed, and freed slots were reused instead of appending
+    assert(ar.tracking.element_num <= TEST_ARENA_THREADS * TEST_ARENA_KEYS);
+    assert(arena_utilization(&ar.tracking) == 0.0f);
+
+    arena_dealloc_U64(&ar);
+
+    printf("%fus\n", timer_elapsed_us(&t));
+
+    return 0;
+}
+
+int test_arena_snapshot(void) {
+    Timer t = timer_start();
+    Arena_U64 ar = arena_create_snapshot_U64();
+    assert(ar.file.fd >= 0);
+
+    U64 n = 20000;
+    ArenaKey* keys = malloc(n * sizeof(ArenaKey));
+    for (U64 i = 0; i < n; ++i) { keys[i] = arena_insert_U64(&ar, i); }
+    assert(arena_save_U64(&ar) == 0);
+
+    // touch a few pages: values, removes and new slots past the saved end
+    *arena_lookup_U64(&ar, keys[5]) = 1000000;
+    for (U64 i = 0; i < n; i += 97) { arena_remove_U64(&ar, keys[i]); }
+    for (U64 i = 0; i < 5000; ++i) { arena_insert_U64(&ar, i); }
+    assert(arena_lookup_U64(&ar, keys[0]) == NULL);
+
+    assert(arena_restore_U64(&ar) == 0);
+    assert(ar.tracking.element_num == n);
+    for (U64 i = 0; i < n; ++i) {
+        U64* v = arena_lookup_U64(&ar, keys[i]);
+        assert(v != NULL && *v == i);
+    }
+    assert(arena_utilization(&ar.tracking) == 1.0f);
+
+    // saving again keeps the changes, restoring after that drops later ones
+    arena_remove_U64(&ar, keys[7]);
+    assert(arena_save_U64(&ar) == 0);
+    arena_remove_U64(&ar, keys[8]);
+    assert(arena_restore_U64(&ar) == 0);
+    assert(arena_lookup_U64(&ar, keys[7]) == NULL);
+    assert(*arena_lookup_U64(&ar, keys[8]) == 8);
+    assert(arena_insert_U64(&ar, 7).idx == 7);
+
+    free(keys);
+    arena_dealloc_U64(&ar);
+
+    printf("%fus\n", timer_elapsed_us(&t));
+
+    return 0;
+}
+
+int test_vm_flags(void) {
+    Timer t = timer_start();
+    Usize huge = VM_HUGE_PAGE_SIZE;
+
+    // hugetlb falls back when the pool is empty, either way the memory works
+    VmFlags all[] = { 0, VM_POPULATE, VM_HUGE_THP, VM_HUGETLB, VM_HUGE_THP | VM_POPULATE };
+    for (U64 i = 0; i < sizeof(all) / sizeof(all[0]); ++i) {
+        U8* p = vm_alloc_flags(2 * huge, all[i]);
+        assert(p != MAP_FAILED);
+        if (all[i] & VM_HUGE_THP) { assert(((Usize)p & (huge - 1)) == 0); }
+        assert(p[0] == 0 && p[2 * huge - 1] == 0);
+        p[0] = 1;
+        p[2 * huge - 1] = 1;
+        vm_dealloc(p, vm_flags_size(2 * huge, all[i]));
+    }
+
+    // reserve, commit, decommit and commit again reads zeros
+    U8* r = vm_reserve_flags(3 * huge + 100, VM_HUGE_THP);
+    assert(r != MAP_FAILED && ((Usize)r & (huge - 1)) == 0);
+    assert(vm_commit_flags(r, huge, VM_POPULATE) == 0);
+    memset(r, 0xab, huge);
+    assert(vm_decommit(r, huge) == 0);
+    assert(vm_commit_flags(r, huge, 0) == 0);
+    assert(r[0] == 0 && r[huge - 1] == 0);
+
+    // growing an unaligned prefix keeps its contents and commits up to the new end
+    assert(vm_commit_grow(r, huge, huge + 100, VM_POPULATE) == 0);
+    r[huge + 99] = 1;
+    assert(vm_commit_grow(r, huge + 100, 3 * huge + 100, VM_POPULATE) == 0);
+    assert(r[huge + 99] == 1 && r[3 * huge + 99] == 0);
+    assert(vm_commit_grow(r, 3 * huge + 100, 3 * huge + 100, 0) == 0);
+    vm_dealloc(r, vm_flags_size(3 * huge + 100, VM_HUGE_THP));
+
+    BumpList b = bump_list_create_flags(VM_HUGE_THP);
+    for (U64 i = 0; i < 2000; ++i) {
+        U8* p = bump_list_alloc(&b, 4096, 64);
+        assert(((Usize)b.alloc_start & (huge - 1)) == 0);
+        memset(p, (int)i, 4096);
+    }
+    bump_list_clear(&b);
+    assert(bump_list_alloc(&b, huge / 2, 8) != NULL);
+    bump_list_dealloc(&b);
+
+    Arena_U64 ar = arena_create_flags_U64(VM_HUGE_THP | VM_POPULATE);
+    U64 n = 10000;
+    ArenaKey* keys = malloc(n * sizeof(ArenaKey));
+    for (U64 i = 0; i < n; ++i) { keys[i] = arena_insert_U64(&ar, i); }
+    for (U64 i = 0; i < n; ++i) { assert(*arena_lookup_U64(&ar, keys[i]) == i); }
+    free(keys);
+    arena_dealloc_U64(&ar);
+
+    printf("%fus\n", timer_elapsed_us(&t));
+
+    return 0;
+}
+
+int test_bump_range(void) {
+    Timer t = timer_start();
+    BumpRange b = bump_range_create();
+    assert(b.start != NULL);
+
+    // small allocations are contiguous and aligned
+    U8* prev = NULL;
+    for (U64 i = 1; i < 1000; ++i) {
+        U8* p = bump_range_alloc(&b, i, 16);
+        assert(((Usize)p & 15) == 0);
+        if (prev != NULL) { assert(p >= prev + i - 1 && p < prev + i - 1 + 16); }
+        memset(p, 0xff, i);
+        prev = p;
+    }
+
+    // bigger than any BumpList page
+    Usize big = (Usize)100 << 20;
+    U8* p = bump_range_alloc(&b, big, 4096);
+    assert(p != NULL && ((Usize)p & 4095) == 0);
+    p[0] = 1;
+    p[big - 1] = 1;
+
+    bump_range_clear(&b);
+    assert(bump_range_alloc(&b, 8, 8) == b.start);
+    assert(b.committed >= p + big);
+
+    // trimmed memory comes back zeroed
+    bump_range_clear_trim(&b, 4096);
+    assert(b.committed < p);
+    U8* q = bump_range_alloc(&b, big, 4096);
+    assert(q == b.start && p[0] == 0 && q[0] == 0xff);
+    bump_range_dealloc(&b);
+
+    // running out of the reservation
+    BumpRange small = bump_range_create_flags((Usize)1 << 20, VM_HUGE_THP);
+    assert(((Usize)small.start & (VM_HUGE_PAGE_SIZE - 1)) == 0);
+    assert(bump_range_alloc(&small, VM_HUGE_PAGE_SIZE, 64) != NULL);
+    assert(bump_range_alloc(&small, 1, 1) == NULL);
+    bump_range_dealloc(&small);
+
+    // an alignment larger than the reservation can't land past its end
+    BumpRange unaligned = bump_range_create_flags((Usize)64 << 10, 0);
+    assert(bump_range_alloc(&unaligned, 1, 1) != NULL);
+    Usize align = (Usize)1 << 20;
+    while ((U8*)ALIGN_TO(unaligned.pos + align - 1, align) <= unaligned.end) { align <<= 1; }
+    assert(bump_range_alloc(&unaligned, 16, align) == NULL);
+    bump_range_dealloc(&unaligned);
+
+    printf("%fus\n", timer_elapsed_us(&t));
+
+    return 0;
+}
+
+#define TEST_POOL_THREADS 4
+
+static void* test_pool_thread(void* ptr) {
+    Pool_U64* pool = ptr;
+    PoolCache cache = {0};
+    U64* live[1000];
+    for (U64 round = 0; round < 20; ++round) {
+        for (U64 i = 0; i < 1000; ++i) {
+            live[i] = pool_cache_alloc_U64(pool, &cache);
+            *live[i] = i;
+        }
+        for (U64 i = 0; i < 1000; ++i) {
+            assert(*live[i] == i);
+            pool_cache_free_U64(pool, &cache, live[i]);
+        }
+    }
+    pool_cache_flush_U64(pool, &cache);
+    assert(cache.count == 0 && cache.free == NULL && cache.batch == NULL);
+    return NULL;
+}
+
+int test_pool(void) {
+    Timer t = timer_start();
+    Pool_PoolTriple pool = pool_create_PoolTriple();
+
+    // more slabs than POOL_EMPTY_MAX keeps, every object distinct and 4 byte aligned
+    U64 n = 100000;
+    PoolTriple** ptrs = malloc(n * sizeof(PoolTriple*));
+    for (U64 i = 0; i < n; ++i) {
+        ptrs[i] = pool_alloc_PoolTriple(&pool);
+        assert(((Usize)ptrs[i] & 3) == 0);
+        *ptrs[i] = (PoolTriple) {{ (U32)i, (U32)i, (U32)i }};
+    }
+    assert(pool.slabs > POOL_EMPTY_MAX);
+    for (U64 i = 0; i < n; ++i) { assert(ptrs[i]->v[0] == i && ptrs[i]->v[2] == i); }
+
+    // free in a scattered order, then the slots come back before new slabs
+    for (U64 i = 0; i < n; i += 3) { pool_free_PoolTriple(&pool, ptrs[i]); }
+    U32 slabs = pool.slabs;
+    for (U64 i = 0; i < n; i += 3) { ptrs[i] = pool_alloc_PoolTriple(&pool); }
+    assert(pool.slabs == slabs);
+
+    // empty slabs past POOL_EMPTY_MAX go back to the OS, trim unmaps the rest
+    for (U64 i = 0; i < n; ++i) { pool_free_PoolTriple(&pool, ptrs[i]); }
+    assert(pool.partial == NULL);
+    assert(pool.slabs == POOL_EMPTY_MAX && pool.empty_num == POOL_EMPTY_MAX);
+    assert(pool_alloc_PoolTriple(&pool) != NULL && pool.slabs == pool.empty_num + 1);
+    pool_trim_PoolTriple(&pool);
+    assert(pool.slabs == 1 && pool.empty == NULL && pool.mapped != NULL);
+    pool_dealloc_PoolTriple(&pool);
+    free(ptrs);
+
+    // a cache sets a full batch aside, hands the older one to the pool whole
+    // when a second fills, and the next cache that runs out takes it back
+    Pool_U64 batched = pool_create_U64();
+    PoolCache a = {0};
+    PoolCache b = {0};
+    U64* objects[2 * POOL_CACHE_BATCH];
+    for (U64 i = 0; i < 2 * POOL_CACHE_BATCH; ++i) { objects[i] = pool_cache_alloc_U64(&batched, &a); }
+    for (U64 i = 0; i < 2 * POOL_CACHE_BATCH; ++i) { pool_cache_free_U64(&batched, &a, objects[i]); }
+    assert(batched.batch_num == 1 && a.count == 0 && a.batch == objects[2 * POOL_CACHE_BATCH - 1]);
+    assert(pool_cache_alloc_U64(&batched, &b) == objects[POOL_CACHE_BATCH - 1]);
+    assert(batched.batch_num == 0 && b.count == POOL_CACHE_BATCH - 1);
+    assert(pool_cache_alloc_U64(&batched, &a) == objects[2 * POOL_CACHE_BATCH - 1] && a.batch == NULL);
+    pool_cache_free_U64(&batched, &a, objects[2 * POOL_CACHE_BATCH - 1]);
+    pool_cache_free_U64(&batched, &b, objects[POOL_CACHE_BATCH - 1]);
+    pool_cache_flush_U64(&batched, &a);
+    pool_cache_flush_U64(&batched, &b);
+    assert(batched.partial == NULL && batched.slabs == batched.empty_num);
+    pool_dealloc_U64(&batched);
+
+    // threads sharing a pool through their caches
+    Pool_U64 shared = pool_create_U64();
+    pthread_t threads[TEST_POOL_THREADS];
+    for (U64 i = 0; i < TEST_POOL_THREADS; ++i) { pthread_create(&threads[i], NULL, test_pool_thread, &shared); }
+    for (U64 i = 0; i < TEST_POOL_THREADS; ++i) { pthread_join(threads[i], NULL); }
+    // the kept batches go back to their slabs on trim
+    pool_trim_U64(&shared);
+    assert(shared.partial == NULL && shared.batch_num == 0 && shared.slabs == 0);
+    pool_dealloc_U64(&shared);
+
+    printf("%fus\n", timer_elapsed_us(&t));
+
+    return 0;
+}
+
 int test_vec(void) {
     Vec_2 a = {{ 1.0, 1.0 }};
     Vec_2 b = {{ 2.0, 3.0 }};
@@ -217,5 +1659,39 @@ int test_vec(void) {
 }
 
 int main(void) {
-    return test_vec();
+    int ret = 0;
+    ret |= test_vec();
+    ret |= test_bump();
+    ret |= test_bump_mark();
+    ret |= test_bump_page_cache();
+    ret |= test_scratch();
+    ret |= test_bump_range();
+    ret |= test_hash();
+    ret |= test_hash_state();
+    ret |= test_hash_batch();
+    ret |= test_set();
+    ret |= test_set_grow();
+    ret |= test_set_shift();
+    ret |= test_set_stats();
+    ret |= test_group_set();
+    ret |= test_map();
+    ret |= test_map_grow();
+    ret |= test_map_incremental();
+    ret |= test_map_shift();
+    ret |= test_map_inline();
+    ret |= test_map_snapshot();
+    ret |= test_group_map();
+    ret |= test_key_map();
+    ret |= test_lookup_batch();
+    ret |= test_concurrent();
+    ret |= test_stack();
+    ret |= test_arena_tracking();
+    ret |= test_arena_iter();
+    ret |= test_arena_grow();
+    ret |= test_slot_map();
+    ret |= test_arena_atomic();
+    ret |= test_arena_snapshot();
+    ret |= test_vm_flags();
+    ret |= test_pool();
+    return ret;
 }
@@ -2,6 +2,16 @@
 #define TOOLS_C
 
 #include "tools.h"
+#include <pthread.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HASH_BATCH_AVX2
+#endif
 
 // round to next power of 2
 U32 round_pow_2(U32 n) {
@@ -14,20 +24,6 @@ U32 round_pow_2(U32 n) {
     return m+1;
 }
 
-U8 lowest_bit_idx(U64 n) {
-    U8 idx = 0;
-
-    n = n & (~n + 1);
-    if ((n & 0x00000000FFFFFFFF) == 0) { idx += 32; }
-    if ((n & 0x0000FFFF0000FFFF) == 0) { idx += 16; }
-    if ((n & 0x00FF00FF00FF00FF) == 0) { idx += 8; }
-    if ((n & 0x0F0F0F0F0F0F0F0F) == 0) { idx += 4; }
-    if ((n & 0x3333333333333333) == 0) { idx += 2; }
-    if ((n & 0x5555555555555555) == 0) { idx += 1; }
-
-    return idx;
-}
-
 // MATH ------------------------------------------------------------------------
 
 #define VEC_DIM 2
@@ -188,64 +184,353 @@ int segment_next(StringSegment* l, char separator) {
 
 // HASHING -----------------------------------------------------------
 
-HashKey murmur_32_scramble(U32 k) {
-    k *= 0xcc9e2d51;
-    k = (k << 15) | (k >> 17);
-    k *= 0x1b873593;
-    return k;
-}
-
 // murmur 3
-HashKey hash_bytes(const U8* key, U64 len) {
-    U32 h = 0x1b873593;
+U32 hash_bytes(const U8* key, U64 len) {
+    U32 h = MURMUR_32_SEED;
     U32 k;
     for (U64 i = len >> 2; i; i--) {
         memcpy(&k, key, sizeof(U32));
         key += sizeof(U32);
-        h ^= murmur_32_scramble(k);
-        h = (h << 13) | (h >> 19);
-        h = h * 5 + 0xe6546b64;
+        h = murmur_32_block(h, k);
     }
     k = 0;
     for (U64 i = len & 3; i; i--) {
         k <<= 8;
         k |= key[i - 1];
     }
-    h ^= murmur_32_scramble(k);
-    h ^= (U32)len;
-    h ^= h >> 16;
-    h *= 0x85ebca6b;
-    h ^= h >> 13;
-    h *= 0xc2b2ae35;
-    h ^= h >> 16;
+    return murmur_32_finish(h, k, len);
+}
+
+HashState hash_state_init(void) {
+    return (HashState) { .h = MURMUR_32_SEED };
+}
+
+void hash_state_update(HashState* state, const U8* data, U64 len) {
+    state->len += len;
+    U32 k;
+
+    // complete a block left over from the last update
+    while (state->buf_len != 0 && len != 0) {
+        state->buf[state->buf_len++] = *data++;
+        len -= 1;
+        if (state->buf_len == sizeof(U32)) {
+            memcpy(&k, state->buf, sizeof(U32));
+            state->h = murmur_32_block(state->h, k);
+            state->buf_len = 0;
+        }
+    }
+
+    for (; len >= sizeof(U32); len -= sizeof(U32)) {
+        memcpy(&k, data, sizeof(U32));
+        data += sizeof(U32);
+        state->h = murmur_32_block(state->h, k);
+    }
+
+    if (len != 0) {
+        memcpy(state->buf, data, len);
+        state->buf_len = (U32)len;
+    }
+}
+
+U32 hash_state_finish(HashState* state) {
+    U32 k = 0;
+    for (U32 i = state->buf_len; i; i--) {
+        k <<= 8;
+        k |= state->buf[i - 1];
+    }
+    return murmur_32_finish(state->h, k, state->len);
+}
+
+#if defined(HASH_BATCH_AVX2) && !defined(HASH_KEY_64)
+
+#define HASH_AVX2 __attribute__((target("avx2")))
+
+HASH_AVX2 static inline __m256i murmur_32_rotl_avx2(__m256i x, int r) {
+    return _mm256_or_si256(_mm256_slli_epi32(x, r), _mm256_srli_epi32(x, 32 - r));
+}
+
+HASH_AVX2 static inline __m256i murmur_32_block_avx2(__m256i h, __m256i k) {
+    k = _mm256_mullo_epi32(k, _mm256_set1_epi32((int)0xcc9e2d51));
+    k = murmur_32_rotl_avx2(k, 15);
+    k = _mm256_mullo_epi32(k, _mm256_set1_epi32((int)0x1b873593));
+    h = _mm256_xor_si256(h, k);
+    h = murmur_32_rotl_avx2(h, 13);
+    h = _mm256_add_epi32(_mm256_mullo_epi32(h, _mm256_set1_epi32(5)), _mm256_set1_epi32((int)0xe6546b64));
+    return h;
+}
+
+HASH_AVX2 static inline __m256i murmur_32_finish_avx2(__m256i h, int len) {
+    h = _mm256_xor_si256(h, _mm256_set1_epi32(len));
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+    h = _mm256_mullo_epi32(h, _mm256_set1_epi32((int)0x85ebca6b));
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 13));
+    h = _mm256_mullo_epi32(h, _mm256_set1_epi32((int)0xc2b2ae35));
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
     return h;
 }
 
+// returns how many keys were hashed, the rest is left to the scalar loop
+HASH_AVX2 static U64 hash_u32_batch_avx2(const U32* keys, HashKey* out, U64 n) {
+    __m256i seed = _mm256_set1_epi32(MURMUR_32_SEED);
+    U64 i = 0;
+    // two independent vectors per step hide the multiply latency
+    for (; i + 16 <= n; i += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(const void*)(keys + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(const void*)(keys + i + 8));
+        a = murmur_32_finish_avx2(murmur_32_block_avx2(seed, a), 4);
+        b = murmur_32_finish_avx2(murmur_32_block_avx2(seed, b), 4);
+        _mm256_storeu_si256((__m256i*)(void*)(out + i), a);
+        _mm256_storeu_si256((__m256i*)(void*)(out + i + 8), b);
+    }
+    return i;
+}
+
+HASH_AVX2 static U64 hash_u64_batch_avx2(const U64* keys, HashKey* out, U64 n) {
+    __m256i seed = _mm256_set1_epi32(MURMUR_32_SEED);
+    U64 i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 a = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)(const void*)(keys + i)));
+        __m256 b = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)(const void*)(keys + i + 4)));
+        // split into low and high halves, the shuffle leaves keys in order 0 1 4 5 2 3 6 7
+        __m256i lo = _mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        __m256i hi = _mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+        __m256i h = murmur_32_block_avx2(murmur_32_block_avx2(seed, lo), hi);
+        h = murmur_32_finish_avx2(h, 8);
+        h = _mm256_permute4x64_epi64(h, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i*)(void*)(out + i), h);
+    }
+    return i;
+}
+
+#endif
+
+void hash_u32_batch(const U32* keys, HashKey* out, U64 n) {
+    U64 i = 0;
+#if defined(HASH_BATCH_AVX2) && !defined(HASH_KEY_64)
+    if (__builtin_cpu_supports("avx2")) { i = hash_u32_batch_avx2(keys, out, n); }
+#endif
+    for (; i < n; ++i) { out[i] = HASH(keys[i]); }
+}
+
+void hash_u64_batch(const U64* keys, HashKey* out, U64 n) {
+    U64 i = 0;
+#if defined(HASH_BATCH_AVX2) && !defined(HASH_KEY_64)
+    if (__builtin_cpu_supports("avx2")) { i = hash_u64_batch_avx2(keys, out, n); }
+#endif
+    for (; i < n; ++i) { out[i] = HASH(keys[i]); }
+}
+
+static const U64 hash_secret[4] = {
+    0xa0761d6478bd642f, 0xe7037ed1a0b428db, 0x8ebc6af09c88c6db, 0x589965cc75374cc3,
+};
+
+__extension__ typedef unsigned __int128 HashU128;
+
+// 64x64 -> 128 multiply, low half in a, high half in b
+static inline void hash_mul(U64* a, U64* b) {
+    HashU128 r = (HashU128)*a * *b;
+    *a = (U64)r;
+    *b = (U64)(r >> 64);
+}
+
+static inline U64 hash_mix(U64 a, U64 b) {
+    hash_mul(&a, &b);
+    return a ^ b;
+}
+
+static inline U64 hash_read_64(const U8* p) {
+    U64 v;
+    memcpy(&v, p, sizeof(U64));
+    return v;
+}
+
+static inline U64 hash_read_32(const U8* p) {
+    U32 v;
+    memcpy(&v, p, sizeof(U32));
+    return v;
+}
+
+static inline U64 hash_64_start(U64 seed) {
+    return seed ^ hash_mix(seed ^ hash_secret[0], hash_secret[1]);
+}
+
+// one 48 byte step, three independent lanes so the multiplies overlap
+static inline void hash_64_block(U64* seed, U64* seed1, U64* seed2, const U8* p) {
+    *seed = hash_mix(hash_read_64(p) ^ hash_secret[1], hash_read_64(p + 8) ^ *seed);
+    *seed1 = hash_mix(hash_read_64(p + 16) ^ hash_secret[2], hash_read_64(p + 24) ^ *seed1);
+    *seed2 = hash_mix(hash_read_64(p + 32) ^ hash_secret[3], hash_read_64(p + 40) ^ *seed2);
+}
+
+// the last i <= 48 bytes at p, of len in total.
+// If len > 16, the 16 bytes before p must be readable.
+static inline U64 hash_64_tail(U64 seed, const U8* p, U64 i, U64 len) {
+    U64 a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            // two overlapping reads from each end cover 4 to 16 bytes
+            U64 mid = (len >> 3) << 2;
+            a = (hash_read_32(p) << 32) | hash_read_32(p + mid);
+            b = (hash_read_32(p + len - 4) << 32) | hash_read_32(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = ((U64)p[0] << 16) | ((U64)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = 0;
+            b = 0;
+        }
+    } else {
+        while (i > 16) {
+            seed = hash_mix(hash_read_64(p) ^ hash_secret[1], hash_read_64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        // last 16 bytes, overlapping what was already mixed
+        a = hash_read_64(p + i - 16);
+        b = hash_read_64(p + i - 8);
+    }
+
+    a ^= hash_secret[1];
+    b ^= seed;
+    hash_mul(&a, &b);
+    return hash_mix(a ^ hash_secret[0] ^ len, b ^ hash_secret[1]);
+}
+
+U64 hash_bytes_64_seed(const U8* key, U64 len, U64 seed) {
+    const U8* p = key;
+    U64 i = len;
+    seed = hash_64_start(seed);
+
+    if (i > 48) {
+        U64 seed1 = seed;
+        U64 seed2 = seed;
+        do {
+            hash_64_block(&seed, &seed1, &seed2, p);
+            p += 48;
+            i -= 48;
+        } while (i > 48);
+        seed ^= seed1 ^ seed2;
+    }
+
+    return hash_64_tail(seed, p, i, len);
+}
+
+U64 hash_bytes_64(const U8* key, U64 len) {
+    return hash_bytes_64_seed(key, len, 0);
+}
+
+HashState64 hash_state_64_init(U64 seed) {
+    seed = hash_64_start(seed);
+    return (HashState64) { .seed = seed, .seed1 = seed, .seed2 = seed };
+}
+
+// A pending block is only mixed once more input arrives, since the last
+// bytes go through hash_64_tail instead.
+void hash_state_64_update(HashState64* state, const U8* data, U64 len) {
+    state->len += len;
+
+    while (len != 0) {
+        if (state->buf_len == 48) {
+            hash_64_block(&state->seed, &state->seed1, &state->seed2, state->buf + 16);
+            memcpy(state->buf, state->buf + 48, 16);
+            state->buf_len = 0;
+        }
+
+        // hash straight from data while more than a block remains
+        if (state->buf_len == 0 && len > 48) {
+            do {
+                hash_64_block(&state->seed, &state->seed1, &state->seed2, data);
+                data += 48;
+                len -= 48;
+            } while (len > 48);
+            memcpy(state->buf, data - 16, 16);
+        }
+
+        U64 n = 48 - state->buf_len;
+        if (n > len) { n = len; }
+        memcpy(state->buf + 16 + state->buf_len, data, n);
+        state->buf_len += (U32)n;
+        data += n;
+        len -= n;
+    }
+}
+
+U64 hash_state_64_finish(HashState64* state) {
+    U64 seed = state->seed;
+    if (state->len > 48) { seed ^= state->seed1 ^ state->seed2; }
+    return hash_64_tail(seed, state->buf + 16, state->buf_len, state->len);
+}
+
 // hash set -------------------------------------------------------------------
 
-// allows for at least size elements
+#ifdef SET_COUNTERS
+static _Thread_local SetCounters set_counters_local;
+#define SET_COUNT(field, n) (set_counters_local.field += (n))
+#else
+#define SET_COUNT(field, n) ((void)0)
+#endif
+
+// most keys a table of mask+1 slots holds before growing.
+// Always leaves one empty slot so probing terminates.
+U32 set_load_limit(U32 mask, F32 max_load) {
+    U64 limit = (U64)(max_load * ((F32)mask + 1.0f));
+    return limit < mask ? (U32)limit : mask;
+}
+
+// smallest power of 2 table that holds size keys below max_load
+U32 set_mask_for(U32 size, F32 max_load, U32 min_mask) {
+    assert(max_load > 0.0f && max_load <= 1.0f);
+
+    F32 min_slots = ceilf((F32)size / max_load);
+    U32 slots = (U32)min_slots;
+    U32 mask = slots > 1 ? round_pow_2(slots)-1 : 1;
+    if (mask < min_mask) { mask = min_mask; }
+    while (set_load_limit(mask, max_load) < size) {
+        mask = mask*2+1;
+    }
+    return mask;
+}
+
+// size for a rehash that fits count + additional keys.
+// Doubles unless tombstones take up at least half of the slots in use.
+U32 set_grow_size(U32 count, U32 grow_at, U32 additional) {
+    U64 needed = (U64)count + additional;
+    U64 size = needed > grow_at / 2 ? (U64)grow_at * 2 : grow_at;
+    if (size < needed) { size = needed; }
+    assert(size <= 0x80000000);
+    return (U32)size;
+}
+
 Set set_create(U32 size) {
-    U32 mask = round_pow_2(size)-1;
+    return set_create_load(size, SET_DEFAULT_MAX_LOAD);
+}
+
+Set set_create_load(U32 size, F32 max_load) {
+    U32 mask = set_mask_for(size, max_load, 0);
 
     return (Set) {
-        .keys = calloc(mask+1, sizeof(HashKey)),
+        .keys = calloc((U64)mask+1, sizeof(HashKey)),
         .mask = mask,
+        .count = 0,
+        .tombstones = 0,
+        .grow_at = set_load_limit(mask, max_load),
+        .max_load = max_load,
     };
 }
 
-// TODO: prevent infinite lookup loops when all elements in keys are nonzero
-
 // high half is key index, or first available index
 // low half is 1 if found, 0 if not found
 U64 set_lookup(Set* set, HashKey key) {
     U32 mask = set->mask;
     HashKey* keys = set->keys;
 
-    U32 idx = key & mask;
+    U32 idx = (U32)key & mask;
     HashKey ele = keys[idx];
+    SET_COUNT(lookups, 1);
+    SET_COUNT(probes, 1);
 
     // don't stop on removed elements (ele == 1)
     while (ele != 0 && ele != key) {
+        SET_COUNT(probes, 1);
         idx += 1;
 
         // wrap on overflow size
@@ -256,16 +541,47 @@ U64 set_lookup(Set* set, HashKey key) {
     return ((U64)idx << 32) ^ (U64)(ele == key);
 }
 
+void set_lookup_batch(Set* set, const HashKey* keys, U64* out, U32 n) {
+    U32 mask = set->mask;
+    HashKey* set_keys = set->keys;
+
+    U32 ahead = n < SET_PREFETCH_DISTANCE ? n : SET_PREFETCH_DISTANCE;
+    for (U32 i = 0; i < ahead; ++i) {
+        __builtin_prefetch(&set_keys[keys[i] & mask]);
+    }
+
+    for (U32 i = 0; i < n; ++i) {
+        if (i + SET_PREFETCH_DISTANCE < n) {
+            __builtin_prefetch(&set_keys[keys[i + SET_PREFETCH_DISTANCE] & mask]);
+        }
+        out[i] = set_lookup(set, keys[i]);
+    }
+}
+
 // returns index in backing array
 U32 set_insert(Set* set, HashKey key) {
     assert(key > 1);
 
+    // only a new key may grow the table, re-inserting must not move indices
+    if ((U64)set->count + set->tombstones + 1 > set->grow_at) {
+        U64 found = set_lookup(set, key);
+        if ((found & 1) == 1) { return (U32)(found >> 32); }
+        set_reserve(set, 1, NULL, 0);
+    }
+
     U32 mask = set->mask;
     HashKey* keys = set->keys;
 
-    U32 idx = key & mask;
+    U32 idx = (U32)key & mask;
     HashKey ele = keys[idx];
-    while (ele > 1 && ele != key) {
+    SET_COUNT(inserts, 1);
+    SET_COUNT(probes, 1);
+
+    // first removed element, which is reused if the key isn't further along
+    U32 removed = ~(U32)0;
+    while (ele != 0 && ele != key) {
+        SET_COUNT(probes, 1);
+        if (ele == 1 && removed == ~(U32)0) { removed = idx; }
         idx += 1;
 
         // wrap on overflow size
@@ -273,6 +589,14 @@ U32 set_insert(Set* set, HashKey key) {
         ele = keys[idx];
     }
 
+    if (ele == key) { return idx; }
+
+    if (removed != ~(U32)0) {
+        idx = removed;
+        set->tombstones -= 1;
+    }
+
+    set->count += 1;
     keys[idx] = key;
     return idx;
 }
@@ -286,6 +610,8 @@ U64 set_remove(Set* set, HashKey key) {
     // Replace with 1. This prevents not finding inserted keys in some cases.
     // Replacing with 0 causes premature stops
     set->keys[ret >> 32] = 1;
+    set->count -= 1;
+    set->tombstones += 1;
     return ret;
 }
 
@@ -293,216 +619,1483 @@ void set_dealloc(Set* set) {
     free(set->keys);
 }
 
-// PRNG -----------------------------------------------------------------------
-
-U64 PRNG_SEEDS[256] = {
-#include "prng_seeds.h"
-};
+void* set_reserve(Set* set, U32 additional, void* values, Usize value_size) {
+    if ((U64)set->count + set->tombstones + additional <= set->grow_at) { return values; }
 
-Prng prng_create(U64 seed) {
-    U64 s = PRNG_SEEDS[seed & (255)];
-    return (Prng) {
-        .x = 0,
-        .w = 0,
-        .s = s,
-    };
+    U32 size = set_grow_size(set->count, set->grow_at, additional);
+    return set_rehash(set, size, values, value_size);
 }
 
-U32 prng_next(Prng* prng) {
-    U64 x = prng->x;
-    U64 w = prng->w;
+void* set_rehash(Set* set, U32 size, void* values, Usize value_size) {
+    assert(size >= set->count);
+    SET_COUNT(rehashes, 1);
 
-    w += prng->s;
-    x = x*x + w;
-    x = (x >> 32) ^ (x << 32);
+    Set new_set = set_create_load(size, set->max_load);
+    U32 new_mask = new_set.mask;
+    HashKey* new_keys = new_set.keys;
 
-    prng->x = x;
-    prng->w = w;
+    U8* new_values = NULL;
+    if (values != NULL) { new_values = malloc(((U64)new_mask+1) * value_size); }
 
-    return (U32) x;
-}
+    HashKey* keys = set->keys;
+    for (U64 i = 0; i <= set->mask; ++i) {
+        HashKey key = keys[i];
+        if (key <= 1) { continue; }
+
+        // keys are unique and the new table has no tombstones, take the first empty slot
+        U32 idx = (U32)key & new_mask;
+        while (new_keys[idx] != 0) {
+            idx = (idx + 1) & new_mask;
+        }
+        new_keys[idx] = key;
 
-// TIMERS --------------------------------------------------------------------
+        if (values != NULL) {
+            memcpy(new_values + (U64)idx * value_size, (U8*)values + i * value_size, value_size);
+        }
+    }
 
-double time_s(TimeSpec t) {
-    return (double)t.tv_sec + (double)t.tv_nsec / 1'000'000'000.0;
+    new_set.count = set->count;
+    set_dealloc(set);
+    free(values);
+    *set = new_set;
+    return new_values;
 }
 
-double time_ms(TimeSpec t) {
-    return (double)t.tv_sec * 1'000.0 + (double)t.tv_nsec / 1'000'000.0;
+// a probe histogram is filled in, the rest is derived from it
+static SetStats set_stats_finish(SetStats stats, U64 probe_sum, F32 expected) {
+    stats.load = (F32)(stats.count + stats.tombstones) / (F32)stats.slots;
+    stats.avg_probe = stats.count == 0 ? 0.0f : (F32)probe_sum / (F32)stats.count;
+    stats.expected_probe = expected;
+    stats.clustered = stats.avg_probe > 2.0f * expected + 1.0f;
+    return stats;
 }
 
-double time_us(TimeSpec t) {
-    return (double)t.tv_sec * 1'000'000.0 + (double)t.tv_nsec / 1'000.0;
+static void set_stats_add_probe(SetStats* stats, U32 probe, U64* probe_sum) {
+    *probe_sum += probe;
+    if (probe > stats->max_probe) { stats->max_probe = probe; }
+    U32 bucket = probe - 1 < SET_PROBE_HISTOGRAM ? probe - 1 : SET_PROBE_HISTOGRAM - 1;
+    stats->histogram[bucket] += 1;
 }
 
-double time_ns(TimeSpec t) {
-    return (double)t.tv_sec * 1'000'000'000.0 + (double)t.tv_nsec;
+SetStats set_stats(Set* set) {
+    return set_stats_stride(set->keys, sizeof(HashKey), set->mask, set->count, set->tombstones);
 }
 
+SetStats set_stats_stride(const void* keys, Usize stride, U32 mask, U32 count, U32 tombstones) {
+    SetStats stats = {
+        .slots = mask + 1,
+        .count = count,
+        .tombstones = tombstones,
+    };
 
-Timer timer_start(void) {
-    Timer t;
-    clock_gettime(CLOCK_MONOTONIC, &t.start);
-    return t;
-}
+    U64 probe_sum = 0;
+    U32 cluster = 0;
+    for (U64 i = 0; i <= mask; ++i) {
+        HashKey key = *(const HashKey*)(const void*)((const U8*)keys + i * stride);
+        if (key == 0) {
+            cluster = 0;
+            continue;
+        }
 
-TimeSpec timer_elapsed(Timer* timer) {
-    TimeSpec t;
-    clock_gettime(CLOCK_MONOTONIC, &t);
-    t.tv_sec -= timer->start.tv_sec;
-    t.tv_nsec -= timer->start.tv_nsec;
-    return t;
+        cluster += 1;
+        if (cluster > stats.max_cluster) { stats.max_cluster = cluster; }
+        if (key == 1) { continue; }
+
+        U32 probe = (((U32)i - (U32)key) & mask) + 1;
+        set_stats_add_probe(&stats, probe, &probe_sum);
+    }
+
+    // clusters can wrap around the end
+    for (U64 i = 0; i <= mask && cluster != 0; ++i) {
+        if (*(const HashKey*)(const void*)((const U8*)keys + i * stride) == 0) { break; }
+        cluster += 1;
+        if (cluster > stats.max_cluster) { stats.max_cluster = cluster; }
+    }
+    if (stats.max_cluster > stats.slots) { stats.max_cluster = stats.slots; }
+
+    // Knuth, successful linear probing search
+    F32 load = (F32)(stats.count + stats.tombstones) / (F32)stats.slots;
+    F32 expected = 0.5f * (1.0f + 1.0f / (1.0f - load));
+    return set_stats_finish(stats, probe_sum, expected);
 }
 
-TimeSpec timer_lap(Timer* timer) {
-    TimeSpec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
-    TimeSpec diff = now;
-    diff.tv_sec -= timer->start.tv_sec;
-    diff.tv_nsec -= timer->start.tv_nsec;
-    timer->start = now;
-    return diff;
+SetCounters set_counters(void) {
+#ifdef SET_COUNTERS
+    return set_counters_local;
+#else
+    return (SetCounters) {0};
+#endif
 }
 
-double timer_elapsed_s(Timer* timer) { return time_s(timer_elapsed(timer)); }
-double timer_elapsed_ms(Timer* timer) { return time_ms(timer_elapsed(timer)); }
-double timer_elapsed_us(Timer* timer) { return time_us(timer_elapsed(timer)); }
-double timer_elapsed_ns(Timer* timer) { return time_ns(timer_elapsed(timer)); }
-double timer_lap_s(Timer* timer) { return time_s(timer_lap(timer)); }
-double timer_lap_ms(Timer* timer) { return time_ms(timer_lap(timer)); }
-double timer_lap_us(Timer* timer) { return time_us(timer_lap(timer)); }
-double timer_lap_ns(Timer* timer) { return time_ns(timer_lap(timer)); }
+void set_counters_reset(void) {
+#ifdef SET_COUNTERS
+    set_counters_local = (SetCounters) {0};
+#endif
+}
 
-// ALLOCATORS ----------------------------------------------------------------
+#define SET_SNAPSHOT_ALIGN 64
+static_assert(sizeof(SetSnapshotHeader) == SET_SNAPSHOT_ALIGN, "keys must start aligned");
 
-static _Thread_local Usize page_size_global = 0;
-Usize page_size(void) {
-    if (page_size_global == 0) {
-        page_size_global = (Usize)sysconf(_SC_PAGESIZE);
-    }
-    return page_size_global;
+static U64 set_snapshot_align(U64 n) {
+    return (n + SET_SNAPSHOT_ALIGN - 1) & ~(U64)(SET_SNAPSHOT_ALIGN - 1);
 }
 
-// always zero initialized
-void* vm_alloc(Usize size) {
-    return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+static U64 set_snapshot_keys_size(U32 mask) {
+    return set_snapshot_align(((U64)mask + 1) * sizeof(HashKey));
 }
 
-int vm_dealloc(void* ptr, Usize size) {
-    return munmap(ptr, size);
+static U64 set_snapshot_size(U32 mask, Usize value_size) {
+    return sizeof(SetSnapshotHeader) + set_snapshot_keys_size(mask) + ((U64)mask + 1) * value_size;
 }
 
-// bump -----------------------------------------------
-
-BumpList bump_list_create(void) {
-    return (BumpList) {
-        .alloc_start = (U8*)~((Usize) 0),
-        .pos         = (U8*)~((Usize) 0),
+int set_save(Set* set, const void* values, Usize value_size, const char* path) {
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) { return 1; }
+
+    SetSnapshotHeader header = {
+        .magic = SET_SNAPSHOT_MAGIC,
+        .version = SET_SNAPSHOT_VERSION,
+        .hash_version = HASH_VERSION,
+        .key_size = sizeof(HashKey),
+        .mask = set->mask,
+        .count = set->count,
+        .tombstones = set->tombstones,
+        .value_size = value_size,
     };
-}
 
-void bump_list_new_page(BumpList* bump) {
-    Usize alloc_size = page_size() * BUMP_PAGE_ALLOC_COUNT;
-    U8* new_alloc_start = vm_alloc(alloc_size);
+    U64 slots = (U64)set->mask + 1;
+    U64 keys_size = slots * sizeof(HashKey);
+    U8 padding[SET_SNAPSHOT_ALIGN] = {0};
 
-    // linked list of ptrs
-    U8** prev_page_pos = (U8**)(new_alloc_start + alloc_size - sizeof(U8*));
-    *((U8**) prev_page_pos) = bump->alloc_start;
+    int err = 0;
+    err |= fwrite(&header, sizeof(header), 1, f) != 1;
+    err |= fwrite(set->keys, keys_size, 1, f) != 1;
+    U64 padding_size = set_snapshot_keys_size(set->mask) - keys_size;
+    if (padding_size != 0) {
+        err |= fwrite(padding, padding_size, 1, f) != 1;
+    }
+    if (value_size != 0) {
+        err |= fwrite(values, slots * value_size, 1, f) != 1;
+    }
 
-    *bump = (BumpList) {
-        .alloc_start = new_alloc_start,
-        .pos = (U8*)prev_page_pos,
-    };
+    err |= fclose(f) != 0;
+    return err;
 }
 
-// alignment must be a power of 2
-void* bump_list_alloc(BumpList* bump, Usize size, Usize align) {
-    if (size == 0) { return NULL; }
+int set_open_mmap(Set* set, void** values, Usize value_size, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { return 1; }
 
-    U8* aligned = ALIGN_TO(bump->pos - size, align);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (U64)st.st_size < sizeof(SetSnapshotHeader)) {
+        close(fd);
+        return 1;
+    }
 
-    if (aligned < bump->alloc_start) {
-        bump_list_new_page(bump);
+    U64 size = (U64)st.st_size;
+    U8* ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) { return 1; }
+
+    const SetSnapshotHeader* header = (const SetSnapshotHeader*)ptr;
+    if (header->magic != SET_SNAPSHOT_MAGIC
+        || header->version != SET_SNAPSHOT_VERSION
+        || header->hash_version != HASH_VERSION
+        || header->key_size != sizeof(HashKey)
+        || header->value_size != value_size
+        || size != set_snapshot_size(header->mask, value_size)
+    ) {
+        munmap(ptr, size);
+        return 1;
+    }
 
-        aligned = ALIGN_TO(bump->pos - size, align);
-        assert(aligned >= bump->alloc_start);
+    U8* keys = ptr + sizeof(SetSnapshotHeader);
+    *set = (Set) {
+        .keys = (HashKey*)keys,
+        .mask = header->mask,
+        .count = header->count,
+        .tombstones = header->tombstones,
+        .grow_at = set_load_limit(header->mask, SET_DEFAULT_MAX_LOAD),
+        .max_load = SET_DEFAULT_MAX_LOAD,
+    };
+
+    if (values != NULL) {
+        *values = value_size == 0 ? NULL : keys + set_snapshot_keys_size(header->mask);
     }
+    return 0;
+}
 
-    bump->pos = aligned;
-    return (void*) aligned;
+void set_close_mmap(Set* set, Usize value_size) {
+    U8* ptr = (U8*)set->keys - sizeof(SetSnapshotHeader);
+    munmap(ptr, set_snapshot_size(set->mask, value_size));
 }
 
-void bump_list_clear(BumpList* bump) {
-    Usize alloc_size = page_size() * BUMP_PAGE_ALLOC_COUNT;
-    U8* page = bump->alloc_start;
+U64 set_remove_shift(Set* set, HashKey key, void* values, Usize value_size) {
+    U64 ret = set_lookup(set, key);
+    if ((ret & 1) == 0) { return ret; }
 
-    // nothing allocated
-    if (~((Usize)page) == 0) { return; }
+    set_remove_at(set, (U32)(ret >> 32), values, value_size);
+    return ret;
+}
+
+void set_remove_at(Set* set, U32 idx, void* values, Usize value_size) {
+    U32 mask = set->mask;
+    HashKey* keys = set->keys;
+    U8* vals = values;
 
+    U32 hole = idx;
+    U32 next = (hole + 1) & mask;
     while (true) {
-        U8* next_page = *((U8**)(page + alloc_size - sizeof(U8*)));
-        if (~((Usize)next_page) == 0) { break; }
-        vm_dealloc(page, alloc_size);
-        page = next_page;
+        HashKey ele = keys[next];
+        if (ele == 0) { break; }
+
+        // tombstones stay where they are
+        U32 home = ele == 1 ? next : (U32)ele & mask;
+
+        // move back if the hole is between the key's home slot and its current slot
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            keys[hole] = ele;
+            if (vals != NULL) {
+                memcpy(vals + (U64)hole * value_size, vals + (U64)next * value_size, value_size);
+            }
+            hole = next;
+        }
+
+        next = (next + 1) & mask;
     }
 
-    bump->alloc_start = page;
-    bump->pos = (U8*)(page + alloc_size - sizeof(U8*));
+    keys[hole] = 0;
+    set->count -= 1;
+}
+
+// group probed hash set ------------------------------------------------------
+
+static U8 group_h2(HashKey key) {
+    return (U8)(key >> (sizeof(HashKey)*8 - 7));
+}
+
+// bit i is set if ctrl[i] == c
+static U32 group_match(const U8* ctrl, U8 c) {
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return (U32)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)c)));
+#else
+    U32 match = 0;
+    for (U32 i = 0; i < GROUP_WIDTH; ++i) {
+        match |= (U32)(ctrl[i] == c) << i;
+    }
+    return match;
+#endif
+}
+
+// bit i is set if ctrl[i] is empty or deleted
+static U32 group_match_free(const U8* ctrl) {
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return (U32)_mm_movemask_epi8(group);
+#else
+    U32 match = 0;
+    for (U32 i = 0; i < GROUP_WIDTH; ++i) {
+        match |= (U32)(ctrl[i] >> 7) << i;
+    }
+    return match;
+#endif
+}
+
+static void group_set_ctrl(GroupSet* set, U32 idx, U8 c) {
+    set->ctrl[idx] = c;
+
+    // keep the mirrored first group in sync
+    if (idx < GROUP_WIDTH) { set->ctrl[set->mask + 1 + idx] = c; }
+}
+
+GroupSet group_set_create(U32 size) {
+    return group_set_create_load(size, SET_DEFAULT_MAX_LOAD);
+}
+
+GroupSet group_set_create_load(U32 size, F32 max_load) {
+    U32 mask = set_mask_for(size, max_load, GROUP_WIDTH-1);
+
+    U64 ctrl_size = (U64)mask + 1 + GROUP_WIDTH;
+    U8* ctrl = malloc(ctrl_size);
+    memset(ctrl, GROUP_CTRL_EMPTY, ctrl_size);
+
+    return (GroupSet) {
+        .ctrl = ctrl,
+        .keys = calloc((U64)mask+1, sizeof(HashKey)),
+        .mask = mask,
+        .count = 0,
+        .tombstones = 0,
+        .grow_at = set_load_limit(mask, max_load),
+        .max_load = max_load,
+    };
+}
+
+// high half is key index, or first available index
+// low half is 1 if found, 0 if not found
+U64 group_set_lookup(GroupSet* set, HashKey key) {
+    U32 mask = set->mask;
+    U8* ctrl = set->ctrl;
+    HashKey* keys = set->keys;
+    U8 h2 = group_h2(key);
+    SET_COUNT(lookups, 1);
+
+    U32 pos = (U32)key & mask;
+    U32 step = 0;
+    while (true) {
+        SET_COUNT(probes, 1);
+        U32 match = group_match(ctrl + pos, h2);
+        while (match != 0) {
+            U32 idx = (pos + lowest_bit_idx(match)) & mask;
+            if (keys[idx] == key) { return ((U64)idx << 32) ^ 1; }
+            match &= match - 1;
+        }
+
+        U32 empty = group_match(ctrl + pos, GROUP_CTRL_EMPTY);
+        if (empty != 0) {
+            U32 idx = (pos + lowest_bit_idx(empty)) & mask;
+            return (U64)idx << 32;
+        }
+
+        // triangular steps visit every group when the size is a power of 2
+        step += GROUP_WIDTH;
+        pos = (pos + step) & mask;
+    }
+}
+
+static void group_set_prefetch(GroupSet* set, HashKey key) {
+    U32 pos = (U32)key & set->mask;
+    __builtin_prefetch(&set->ctrl[pos]);
+    __builtin_prefetch(&set->keys[pos]);
+}
+
+void group_set_lookup_batch(GroupSet* set, const HashKey* keys, U64* out, U32 n) {
+    U32 ahead = n < SET_PREFETCH_DISTANCE ? n : SET_PREFETCH_DISTANCE;
+    for (U32 i = 0; i < ahead; ++i) {
+        group_set_prefetch(set, keys[i]);
+    }
+
+    for (U32 i = 0; i < n; ++i) {
+        if (i + SET_PREFETCH_DISTANCE < n) {
+            group_set_prefetch(set, keys[i + SET_PREFETCH_DISTANCE]);
+        }
+        out[i] = group_set_lookup(set, keys[i]);
+    }
+}
+
+// returns index in backing array
+U32 group_set_insert(GroupSet* set, HashKey key) {
+    assert(key > 1);
+
+    // only a new key may grow the table, re-inserting must not move indices
+    if ((U64)set->count + set->tombstones + 1 > set->grow_at) {
+        U64 found = group_set_lookup(set, key);
+        if ((found & 1) == 1) { return (U32)(found >> 32); }
+        group_set_reserve(set, 1, NULL, 0);
+    }
+
+    U32 mask = set->mask;
+    U8* ctrl = set->ctrl;
+    HashKey* keys = set->keys;
+    U8 h2 = group_h2(key);
+
+    // first empty or deleted slot in the probe sequence
+    U32 target = ~(U32)0;
+    SET_COUNT(inserts, 1);
+
+    U32 pos = (U32)key & mask;
+    U32 step = 0;
+    while (true) {
+        SET_COUNT(probes, 1);
+        U32 match = group_match(ctrl + pos, h2);
+        while (match != 0) {
+            U32 idx = (pos + lowest_bit_idx(match)) & mask;
+            if (keys[idx] == key) { return idx; }
+            match &= match - 1;
+        }
+
+        if (target == ~(U32)0) {
+            U32 free = group_match_free(ctrl + pos);
+            if (free != 0) { target = (pos + lowest_bit_idx(free)) & mask; }
+        }
+
+        // the key can't be past an empty slot
+        if (group_match(ctrl + pos, GROUP_CTRL_EMPTY) != 0) { break; }
+
+        step += GROUP_WIDTH;
+        pos = (pos + step) & mask;
+    }
+
+    if (ctrl[target] == GROUP_CTRL_DELETED) { set->tombstones -= 1; }
+    set->count += 1;
+
+    group_set_ctrl(set, target, h2);
+    keys[target] = key;
+    return target;
+}
+
+// high half is key index, or first available index
+// low half is 1 if found, 0 if not found
+U64 group_set_remove(GroupSet* set, HashKey key) {
+    U64 ret = group_set_lookup(set, key);
+    if ((ret & 1) == 0) { return ret; }
+
+    U32 idx = (U32)(ret >> 32);
+    group_set_ctrl(set, idx, GROUP_CTRL_DELETED);
+    set->keys[idx] = 1;
+    set->count -= 1;
+    set->tombstones += 1;
+    return ret;
+}
+
+void group_set_dealloc(GroupSet* set) {
+    free(set->ctrl);
+    free(set->keys);
+}
+
+void* group_set_reserve(GroupSet* set, U32 additional, void* values, Usize value_size) {
+    if ((U64)set->count + set->tombstones + additional <= set->grow_at) { return values; }
+
+    U32 size = set_grow_size(set->count, set->grow_at, additional);
+    return group_set_rehash(set, size, values, value_size);
+}
+
+void* group_set_rehash(GroupSet* set, U32 size, void* values, Usize value_size) {
+    assert(size >= set->count);
+    SET_COUNT(rehashes, 1);
+
+    GroupSet new_set = group_set_create_load(size, set->max_load);
+    U32 new_mask = new_set.mask;
+
+    U8* new_values = NULL;
+    if (values != NULL) { new_values = malloc(((U64)new_mask+1) * value_size); }
+
+    HashKey* keys = set->keys;
+    for (U64 i = 0; i <= set->mask; ++i) {
+        HashKey key = keys[i];
+        if (key <= 1) { continue; }
+
+        // keys are unique and the new table has no tombstones, take the first empty slot
+        U32 pos = (U32)key & new_mask;
+        U32 step = 0;
+        U32 empty = group_match(new_set.ctrl + pos, GROUP_CTRL_EMPTY);
+        while (empty == 0) {
+            step += GROUP_WIDTH;
+            pos = (pos + step) & new_mask;
+            empty = group_match(new_set.ctrl + pos, GROUP_CTRL_EMPTY);
+        }
+
+        U32 idx = (pos + lowest_bit_idx(empty)) & new_mask;
+        group_set_ctrl(&new_set, idx, group_h2(key));
+        new_set.keys[idx] = key;
+
+        if (values != NULL) {
+            memcpy(new_values + (U64)idx * value_size, (U8*)values + i * value_size, value_size);
+        }
+    }
+
+    new_set.count = set->count;
+    group_set_dealloc(set);
+    free(values);
+    *set = new_set;
+    return new_values;
+}
+
+SetStats group_set_stats(GroupSet* set) {
+    U32 mask = set->mask;
+    HashKey* keys = set->keys;
+    SetStats stats = {
+        .slots = mask + 1,
+        .count = set->count,
+        .tombstones = set->tombstones,
+    };
+
+    U64 probe_sum = 0;
+    U32 cluster = 0;
+    for (U64 i = 0; i <= mask; ++i) {
+        HashKey key = keys[i];
+        if (key == 0) {
+            cluster = 0;
+            continue;
+        }
+
+        cluster += 1;
+        if (cluster > stats.max_cluster) { stats.max_cluster = cluster; }
+        if (key == 1) { continue; }
+
+        // replay the probe sequence until a group covers slot i
+        U32 pos = (U32)key & mask;
+        U32 step = 0;
+        U32 probe = 1;
+        while ((((U32)i - pos) & mask) >= GROUP_WIDTH) {
+            step += GROUP_WIDTH;
+            pos = (pos + step) & mask;
+            probe += 1;
+        }
+        set_stats_add_probe(&stats, probe, &probe_sum);
+    }
+
+    // a group holds no empty slot with probability about load^GROUP_WIDTH
+    F32 load = (F32)(stats.count + stats.tombstones) / (F32)stats.slots;
+    F32 expected = 1.0f / (1.0f - powf(load, GROUP_WIDTH));
+    return set_stats_finish(stats, probe_sum, expected);
+}
+
+// concurrent hash set -------------------------------------------------------
+
+static ConcurrentSetTable* concurrent_set_table_create(U32 size, Usize value_size, F32 max_load) {
+    U32 mask = set_mask_for(size, max_load, 0);
+    ConcurrentSetTable* table = malloc(sizeof(ConcurrentSetTable));
+
+    *table = (ConcurrentSetTable) {
+        .keys = calloc((U64)mask+1, sizeof(HashKey)),
+        .values = value_size == 0 ? NULL : malloc(((U64)mask+1) * value_size),
+        .ready = calloc((U64)mask+1, 1),
+        .mask = mask,
+        .grow_at = set_load_limit(mask, max_load),
+        .used = 0,
+        .removed = 0,
+        .writers = 0,
+        .frozen = 0,
+        .retired = NULL,
+    };
+    return table;
+}
+
+static void concurrent_set_table_dealloc(ConcurrentSetTable* table) {
+    free(table->keys);
+    free(table->values);
+    free(table->ready);
+    free(table);
+}
+
+ConcurrentSet concurrent_set_create(U32 size, Usize value_size) {
+    return (ConcurrentSet) {
+        .table = concurrent_set_table_create(size, value_size, SET_DEFAULT_MAX_LOAD),
+        .value_size = value_size,
+        .max_load = SET_DEFAULT_MAX_LOAD,
+    };
+}
+
+void* concurrent_set_lookup(ConcurrentSet* set, HashKey key) {
+    ConcurrentSetTable* table = __atomic_load_n(&set->table, __ATOMIC_ACQUIRE);
+    U32 mask = table->mask;
+
+    U32 idx = (U32)key & mask;
+    while (true) {
+        HashKey ele = __atomic_load_n(&table->keys[idx], __ATOMIC_ACQUIRE);
+        if (ele == 0) { return NULL; }
+
+        if (ele == key) {
+            // key is claimed but the insert isn't done, it happens after this lookup
+            if (__atomic_load_n(&table->ready[idx], __ATOMIC_ACQUIRE) == 0) { return NULL; }
+            if (table->values == NULL) { return &table->keys[idx]; }
+            return table->values + (U64)idx * set->value_size;
+        }
+
+        // wrap on overflow size
+        idx = (idx + 1) & mask;
+    }
+}
+
+// returns the table a writer entered, waiting while it is being replaced
+static ConcurrentSetTable* concurrent_set_enter(ConcurrentSet* set) {
+    while (true) {
+        ConcurrentSetTable* table = __atomic_load_n(&set->table, __ATOMIC_ACQUIRE);
+
+        // pairs with the frozen store and writers load in concurrent_set_grow
+        __atomic_add_fetch(&table->writers, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&table->frozen, __ATOMIC_SEQ_CST) == 0) { return table; }
+        __atomic_sub_fetch(&table->writers, 1, __ATOMIC_RELEASE);
+
+        while (__atomic_load_n(&set->table, __ATOMIC_ACQUIRE) == table) {
+            sched_yield();
+        }
+    }
+}
+
+static void concurrent_set_leave(ConcurrentSetTable* table) {
+    __atomic_sub_fetch(&table->writers, 1, __ATOMIC_RELEASE);
+}
+
+// replaces a full table, or waits for the writer that is already replacing it
+static void concurrent_set_grow(ConcurrentSet* set, ConcurrentSetTable* table) {
+    U32 expected = 0;
+    if (!__atomic_compare_exchange_n(&table->frozen, &expected, 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        while (__atomic_load_n(&set->table, __ATOMIC_ACQUIRE) == table) {
+            sched_yield();
+        }
+        return;
+    }
+
+    while (__atomic_load_n(&table->writers, __ATOMIC_SEQ_CST) != 0) {
+        sched_yield();
+    }
+
+    U32 live = table->used - table->removed;
+    U32 size = set_grow_size(live, table->grow_at, 1);
+    ConcurrentSetTable* new_table = concurrent_set_table_create(size, set->value_size, set->max_load);
+    U32 new_mask = new_table->mask;
+    Usize value_size = set->value_size;
+
+    // no writers are left, so every claimed slot has its value
+    for (U64 i = 0; i <= table->mask; ++i) {
+        HashKey key = table->keys[i];
+        if (key <= 1) { continue; }
+
+        U32 idx = (U32)key & new_mask;
+        while (new_table->keys[idx] != 0) {
+            idx = (idx + 1) & new_mask;
+        }
+
+        new_table->keys[idx] = key;
+        new_table->ready[idx] = 1;
+        if (value_size != 0) {
+            memcpy(new_table->values + (U64)idx * value_size, table->values + i * value_size, value_size);
+        }
+    }
+
+    new_table->used = live;
+    new_table->retired = table;
+    __atomic_store_n(&set->table, new_table, __ATOMIC_RELEASE);
+}
+
+bool concurrent_set_insert(ConcurrentSet* set, HashKey key, const void* value) {
+    assert(key > 1);
+
+    while (true) {
+        ConcurrentSetTable* table = concurrent_set_enter(set);
+        U32 mask = table->mask;
+        bool full = false;
+
+        U32 idx = (U32)key & mask;
+        while (true) {
+            HashKey ele = __atomic_load_n(&table->keys[idx], __ATOMIC_ACQUIRE);
+            if (ele == key) {
+                concurrent_set_leave(table);
+                return false;
+            }
+
+            if (ele == 0) {
+                // reserve room before claiming, so there is always an empty slot
+                if (__atomic_fetch_add(&table->used, 1, __ATOMIC_RELAXED) >= table->grow_at) {
+                    __atomic_sub_fetch(&table->used, 1, __ATOMIC_RELAXED);
+                    full = true;
+                    break;
+                }
+
+                if (__atomic_compare_exchange_n(&table->keys[idx], &ele, key, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                    if (value != NULL && set->value_size != 0) {
+                        memcpy(table->values + (U64)idx * set->value_size, value, set->value_size);
+                    }
+                    __atomic_store_n(&table->ready[idx], 1, __ATOMIC_RELEASE);
+                    concurrent_set_leave(table);
+                    return true;
+                }
+
+                // lost the slot, ele is the key that won it and is checked again
+                __atomic_sub_fetch(&table->used, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+
+            // wrap on overflow size
+            idx = (idx + 1) & mask;
+        }
+
+        concurrent_set_leave(table);
+        if (full) { concurrent_set_grow(set, table); }
+    }
+}
+
+bool concurrent_set_remove(ConcurrentSet* set, HashKey key) {
+    ConcurrentSetTable* table = concurrent_set_enter(set);
+    U32 mask = table->mask;
+
+    U32 idx = (U32)key & mask;
+    while (true) {
+        HashKey ele = __atomic_load_n(&table->keys[idx], __ATOMIC_ACQUIRE);
+        if (ele == 0) { break; }
+
+        if (ele == key) {
+            if (__atomic_compare_exchange_n(&table->keys[idx], &ele, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                __atomic_add_fetch(&table->removed, 1, __ATOMIC_RELAXED);
+                concurrent_set_leave(table);
+                return true;
+            }
+
+            // another remove won, a key is never in two slots
+            break;
+        }
+
+        // wrap on overflow size
+        idx = (idx + 1) & mask;
+    }
+
+    concurrent_set_leave(table);
+    return false;
+}
+
+void concurrent_set_reclaim(ConcurrentSet* set) {
+    ConcurrentSetTable* retired = set->table->retired;
+    set->table->retired = NULL;
+
+    while (retired != NULL) {
+        ConcurrentSetTable* next = retired->retired;
+        concurrent_set_table_dealloc(retired);
+        retired = next;
+    }
+}
+
+void concurrent_set_dealloc(ConcurrentSet* set) {
+    concurrent_set_reclaim(set);
+    concurrent_set_table_dealloc(set->table);
+}
+
+// PRNG -----------------------------------------------------------------------
+
+U64 PRNG_SEEDS[256] = {
+#include "prng_seeds.h"
+};
+
+Prng prng_create(U64 seed) {
+    U64 s = PRNG_SEEDS[seed & (255)];
+    return (Prng) {
+        .x = 0,
+        .w = 0,
+        .s = s,
+    };
+}
+
+U32 prng_next(Prng* prng) {
+    U64 x = prng->x;
+    U64 w = prng->w;
+
+    w += prng->s;
+    x = x*x + w;
+    x = (x >> 32) ^ (x << 32);
+
+    prng->x = x;
+    prng->w = w;
+
+    return (U32) x;
+}
+
+// TIMERS --------------------------------------------------------------------
+
+double time_s(TimeSpec t) {
+    return (double)t.tv_sec + (double)t.tv_nsec / 1'000'000'000.0;
+}
+
+double time_ms(TimeSpec t) {
+    return (double)t.tv_sec * 1'000.0 + (double)t.tv_nsec / 1'000'000.0;
+}
+
+double time_us(TimeSpec t) {
+    return (double)t.tv_sec * 1'000'000.0 + (double)t.tv_nsec / 1'000.0;
+}
+
+double time_ns(TimeSpec t) {
+    return (double)t.tv_sec * 1'000'000'000.0 + (double)t.tv_nsec;
+}
+
+
+Timer timer_start(void) {
+    Timer t;
+    clock_gettime(CLOCK_MONOTONIC, &t.start);
+    return t;
+}
+
+TimeSpec timer_elapsed(Timer* timer) {
+    TimeSpec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    t.tv_sec -= timer->start.tv_sec;
+    t.tv_nsec -= timer->start.tv_nsec;
+    return t;
+}
+
+TimeSpec timer_lap(Timer* timer) {
+    TimeSpec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    TimeSpec diff = now;
+    diff.tv_sec -= timer->start.tv_sec;
+    diff.tv_nsec -= timer->start.tv_nsec;
+    timer->start = now;
+    return diff;
+}
+
+double timer_elapsed_s(Timer* timer) { return time_s(timer_elapsed(timer)); }
+double timer_elapsed_ms(Timer* timer) { return time_ms(timer_elapsed(timer)); }
+double timer_elapsed_us(Timer* timer) { return time_us(timer_elapsed(timer)); }
+double timer_elapsed_ns(Timer* timer) { return time_ns(timer_elapsed(timer)); }
+double timer_lap_s(Timer* timer) { return time_s(timer_lap(timer)); }
+double timer_lap_ms(Timer* timer) { return time_ms(timer_lap(timer)); }
+double timer_lap_us(Timer* timer) { return time_us(timer_lap(timer)); }
+double timer_lap_ns(Timer* timer) { return time_ns(timer_lap(timer)); }
+
+// ALLOCATORS ----------------------------------------------------------------
+
+static _Thread_local Usize page_size_global = 0;
+Usize page_size(void) {
+    if (page_size_global == 0) {
+        page_size_global = (Usize)sysconf(_SC_PAGESIZE);
+    }
+    return page_size_global;
+}
+
+// always zero initialized
+void* vm_alloc(Usize size) {
+    return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+}
+
+int vm_dealloc(void* ptr, Usize size) {
+    return munmap(ptr, size);
+}
+
+void* vm_reserve(Usize size) {
+    return mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+}
+
+int vm_commit(void* ptr, Usize size) {
+    return mprotect(ptr, size, PROT_READ | PROT_WRITE);
+}
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+#ifndef MADV_HUGEPAGE
+#define MADV_HUGEPAGE 14
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+// Over-reserves by align and unmaps the ends. size must be a multiple of the page size.
+static void* vm_map_aligned(Usize size, Usize align, int prot, int map_flags) {
+    U8* ptr = mmap(NULL, size + align, prot, MAP_PRIVATE | MAP_ANONYMOUS | map_flags, -1, 0);
+    if (ptr == MAP_FAILED) { return MAP_FAILED; }
+
+    U8* aligned = (U8*)(((Usize)ptr + align - 1) & ~(align - 1));
+    Usize head = (Usize)(aligned - ptr);
+    if (head != 0) { munmap(ptr, head); }
+    munmap(aligned + size, align - head);
+    return aligned;
+}
+
+// the kernel can't back any of a region with huge pages unless it's huge page aligned
+static void* vm_map_huge_aligned(Usize size, int prot, int map_flags) {
+    size = vm_flags_size(size, VM_HUGE_THP);
+    U8* ptr = vm_map_aligned(size, VM_HUGE_PAGE_SIZE, prot, map_flags);
+    if (ptr != MAP_FAILED) { madvise(ptr, size, MADV_HUGEPAGE); }
+    return ptr;
+}
+
+void* vm_alloc_aligned(Usize size, Usize align) {
+    if (align <= page_size()) { return vm_alloc(size); }
+    size = (size + page_size() - 1) & ~(page_size() - 1);
+    return vm_map_aligned(size, align, PROT_READ | PROT_WRITE, 0);
+}
+
+// touches a byte per page when MADV_POPULATE_WRITE isn't supported (before 5.14)
+static int vm_populate(void* ptr, Usize size) {
+    if (madvise(ptr, size, MADV_POPULATE_WRITE) == 0) { return 0; }
+
+    Usize page = page_size();
+    volatile U8* p = ptr;
+    for (Usize i = 0; i < size; i += page) { p[i] = p[i]; }
+    return 0;
+}
+
+void* vm_alloc_flags(Usize size, VmFlags flags) {
+    int populate = (flags & VM_POPULATE) ? MAP_POPULATE : 0;
+
+    if ((flags & VM_HUGETLB) && size % VM_HUGE_PAGE_SIZE == 0) {
+        void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | populate, -1, 0);
+        if (ptr != MAP_FAILED) { return ptr; }
+    }
+
+    if (flags & (VM_HUGE_THP | VM_HUGETLB)) {
+        // populate after madvise so the faults can already use huge pages
+        void* ptr = vm_map_huge_aligned(size, PROT_READ | PROT_WRITE, 0);
+        if (ptr != MAP_FAILED && populate) { vm_populate(ptr, size); }
+        return ptr;
+    }
+
+    return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | populate, -1, 0);
+}
+
+void* vm_reserve_flags(Usize size, VmFlags flags) {
+    if (flags & (VM_HUGE_THP | VM_HUGETLB)) {
+        return vm_map_huge_aligned(size, PROT_NONE, MAP_NORESERVE);
+    }
+    return vm_reserve(size);
+}
+
+int vm_commit_flags(void* ptr, Usize size, VmFlags flags) {
+    int ret = vm_commit(ptr, size);
+    if (ret == 0 && (flags & VM_POPULATE)) { ret = vm_populate(ptr, size); }
+    return ret;
+}
+
+int vm_commit_grow(void* ptr, Usize old_size, Usize new_size, VmFlags flags) {
+    Usize start = old_size & ~(page_size() - 1);
+    if (new_size <= start) { return 0; }
+    return vm_commit_flags((U8*)ptr + start, new_size - start, flags);
+}
+
+int vm_decommit(void* ptr, Usize size) {
+    Usize page = page_size();
+    size = (size + page - 1) & ~(page - 1);
+    if (madvise(ptr, size, MADV_DONTNEED) != 0) { return 1; }
+    return mprotect(ptr, size, PROT_NONE);
+}
+
+void vm_release(void* ptr, Usize start, Usize end) {
+    Usize page = page_size();
+    Usize base = (Usize)ptr;
+    Usize lo = (base + start) & ~(page - 1);
+    Usize hi = (base + end) & ~(page - 1);
+    if (lo < base) { lo = (base + page - 1) & ~(page - 1); }
+    if (hi > lo) { madvise((void*)lo, hi - lo, MADV_DONTNEED); }
+}
+
+void vm_prefault(void* ptr, Usize start, Usize end) {
+    Usize page = page_size();
+    Usize base = (Usize)ptr;
+    Usize lo = (base + start) & ~(page - 1);
+    Usize hi = (base + end) & ~(page - 1);
+    if (lo < base) { lo = (base + page - 1) & ~(page - 1); }
+    if (hi > lo) { vm_populate((void*)lo, hi - lo); }
+}
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 1u
+#endif
+
+VmFile vm_file_reserve(Usize size) {
+    VmFile file = { .ptr = NULL, .size = size, .fd = -1 };
+
+    int fd = (int)syscall(SYS_memfd_create, "vm_file", MFD_CLOEXEC);
+    if (fd < 0) { return file; }
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        return file;
+    }
+
+    void* ptr = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+    if (ptr == MAP_FAILED) {
+        close(fd);
+        return file;
+    }
+
+    file.ptr = ptr;
+    file.fd = fd;
+    return file;
+}
+
+#define VM_PAGEMAP_PRESENT (1ul << 63)
+#define VM_PAGEMAP_SWAPPED (1ul << 62)
+#define VM_PAGEMAP_FILE    (1ul << 61)
+#define VM_PAGEMAP_BATCH 512
+
+// Writes back a run of dirty pages and drops the private copies, which then
+// map the file again.
+static int vm_file_flush(VmFile* file, Usize start, Usize end) {
+    Usize len = end - start;
+    if (pwrite(file->fd, file->ptr + start, len, (off_t)start) != (ssize_t)len) { return 1; }
+    return madvise(file->ptr + start, len, MADV_DONTNEED) != 0;
+}
+
+// A private page that was written to is anonymous, or swapped out.
+// /proc/self/pagemap tells them apart from pages still mapping the file.
+int vm_file_save_range(VmFile* file, Usize offset, Usize size) {
+    int pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if (pagemap < 0) { return 1; }
+
+    Usize page = page_size();
+    Usize first_page = offset / page;
+    Usize end_page = (offset + size + page - 1) / page;
+    U64 entries[VM_PAGEMAP_BATCH];
+    off_t pagemap_start = (off_t)((Usize)file->ptr / page * sizeof(U64));
+
+    int ret = 0;
+    Usize run_start = 0;
+    bool in_run = false;
+    for (Usize p = first_page; p < end_page && ret == 0; p += VM_PAGEMAP_BATCH) {
+        Usize n = end_page - p < VM_PAGEMAP_BATCH ? end_page - p : VM_PAGEMAP_BATCH;
+        Usize bytes = n * sizeof(U64);
+        if (pread(pagemap, entries, bytes, pagemap_start + (off_t)(p * sizeof(U64))) != (ssize_t)bytes) {
+            ret = 1;
+            break;
+        }
+
+        for (Usize i = 0; i < n; ++i) {
+            U64 e = entries[i];
+            bool dirty = ((e & VM_PAGEMAP_PRESENT) && !(e & VM_PAGEMAP_FILE)) || (e & VM_PAGEMAP_SWAPPED);
+            if (dirty && !in_run) {
+                run_start = (p + i) * page;
+                in_run = true;
+            } else if (!dirty && in_run) {
+                ret |= vm_file_flush(file, run_start, (p + i) * page);
+                in_run = false;
+            }
+        }
+    }
+    if (in_run && ret == 0) { ret = vm_file_flush(file, run_start, end_page * page); }
+
+    close(pagemap);
+    return ret;
+}
+
+int vm_file_save(VmFile* file) {
+    return vm_file_save_range(file, 0, file->size);
+}
+
+int vm_file_restore_range(VmFile* file, Usize offset, Usize size) {
+    Usize page = page_size();
+    Usize start = offset / page * page;
+    Usize end = (offset + size + page - 1) / page * page;
+    if (end == start) { return 0; }
+    return madvise(file->ptr + start, end - start, MADV_DONTNEED) != 0;
+}
+
+int vm_file_restore(VmFile* file) {
+    return vm_file_restore_range(file, 0, file->size);
+}
+
+void vm_file_dealloc(VmFile* file) {
+    munmap(file->ptr, file->size);
+    close(file->fd);
+    file->fd = -1;
+}
+
+// bump -----------------------------------------------
+
+BumpList bump_list_create(void) {
+    return bump_list_create_flags(0);
+}
+
+BumpList bump_list_create_flags(VmFlags flags) {
+    return (BumpList) {
+        .alloc_start = (U8*)~((Usize) 0),
+        .pos         = (U8*)~((Usize) 0),
+        .flags       = flags,
+    };
+}
+
+static Usize bump_list_page_size(BumpList* bump) {
+    if (bump->flags & (VM_HUGE_THP | VM_HUGETLB)) { return VM_HUGE_PAGE_SIZE; }
+    return page_size() * BUMP_PAGE_ALLOC_COUNT;
+}
+
+// cached pages are linked through the same slot as pages of a list,
+// one list for normal pages and one for huge pages
+static _Thread_local U8* bump_page_cache[2];
+static _Thread_local Usize bump_page_cache_max = BUMP_PAGE_CACHE_LIMIT;
+static _Thread_local BumpPageCounters bump_page_counters_local;
+
+// A key destructor frees the scratch lists and page cache of a thread that
+// used them when it exits. Registered on first use.
+static pthread_key_t bump_thread_key;
+static pthread_once_t bump_thread_once = PTHREAD_ONCE_INIT;
+static _Thread_local bool bump_thread_registered = false;
+
+static void bump_thread_exit(void* unused) {
+    (void)unused;
+    scratch_dealloc();
+    // anything cached by later destructors registers again
+    bump_thread_registered = false;
+}
+
+static void bump_thread_key_create(void) {
+    pthread_key_create(&bump_thread_key, bump_thread_exit);
+}
+
+static void bump_thread_register(void) {
+    if (bump_thread_registered) { return; }
+    bump_thread_registered = true;
+    pthread_once(&bump_thread_once, bump_thread_key_create);
+    // the destructor only runs for a non NULL value
+    pthread_setspecific(bump_thread_key, &bump_thread_registered);
+}
+
+static U8** bump_page_next(U8* page, Usize alloc_size) {
+    return (U8**)(page + alloc_size - sizeof(U8*));
+}
+
+static U8* bump_page_get(BumpList* bump, Usize alloc_size) {
+    U8** cache = &bump_page_cache[(bump->flags & (VM_HUGE_THP | VM_HUGETLB)) != 0];
+    U8* page = *cache;
+    if (page != NULL) {
+        *cache = *bump_page_next(page, alloc_size);
+        bump_page_counters_local.reuses += 1;
+        bump_page_counters_local.cached -= alloc_size;
+        return page;
+    }
+
+    bump_page_counters_local.maps += 1;
+    return vm_alloc_flags(alloc_size, bump->flags);
+}
+
+static void bump_page_put(BumpList* bump, U8* page, Usize alloc_size) {
+    if (bump_page_counters_local.cached + alloc_size > bump_page_cache_max) {
+        bump_page_counters_local.unmaps += 1;
+        vm_dealloc(page, alloc_size);
+        return;
+    }
+
+    bump_thread_register();
+    U8** cache = &bump_page_cache[(bump->flags & (VM_HUGE_THP | VM_HUGETLB)) != 0];
+    *bump_page_next(page, alloc_size) = *cache;
+    *cache = page;
+    bump_page_counters_local.cached += alloc_size;
+}
+
+BumpPageCounters bump_page_counters(void) {
+    return bump_page_counters_local;
+}
+
+void bump_page_counters_reset(void) {
+    Usize cached = bump_page_counters_local.cached;
+    bump_page_counters_local = (BumpPageCounters) { .cached = cached };
+}
+
+// unmaps cached pages until at most bytes are left, huge pages first
+static void bump_page_cache_shrink(Usize bytes) {
+    Usize sizes[2] = { page_size() * BUMP_PAGE_ALLOC_COUNT, VM_HUGE_PAGE_SIZE };
+    for (U32 i = 2; i-- > 0;) {
+        while (bump_page_cache[i] != NULL && bump_page_counters_local.cached > bytes) {
+            U8* page = bump_page_cache[i];
+            bump_page_cache[i] = *bump_page_next(page, sizes[i]);
+            vm_dealloc(page, sizes[i]);
+            bump_page_counters_local.unmaps += 1;
+            bump_page_counters_local.cached -= sizes[i];
+        }
+    }
+}
+
+void bump_page_cache_limit(Usize bytes) {
+    bump_page_cache_max = bytes;
+    bump_page_cache_shrink(bytes);
+}
+
+void bump_page_cache_trim(void) {
+    bump_page_cache_shrink(0);
+}
+
+void bump_list_new_page(BumpList* bump) {
+    Usize alloc_size = bump_list_page_size(bump);
+    U8* new_alloc_start = bump_page_get(bump, alloc_size);
+
+    // linked list of ptrs
+    U8** prev_page_pos = (U8**)(new_alloc_start + alloc_size - sizeof(U8*));
+    *((U8**) prev_page_pos) = bump->alloc_start;
+
+    bump->alloc_start = new_alloc_start;
+    bump->pos = (U8*)prev_page_pos;
+}
+
+// alignment must be a power of 2
+void* bump_list_alloc(BumpList* bump, Usize size, Usize align) {
+    if (size == 0) { return NULL; }
+
+    U8* aligned = ALIGN_TO(bump->pos - size, align);
+
+    if (aligned < bump->alloc_start) {
+        bump_list_new_page(bump);
+
+        aligned = ALIGN_TO(bump->pos - size, align);
+        assert(aligned >= bump->alloc_start);
+    }
+
+    bump->pos = aligned;
+    return (void*) aligned;
+}
+
+void bump_list_clear(BumpList* bump) {
+    Usize alloc_size = bump_list_page_size(bump);
+    U8* page = bump->alloc_start;
+
+    // nothing allocated
+    if (~((Usize)page) == 0) { return; }
+
+    while (true) {
+        U8* next_page = *((U8**)(page + alloc_size - sizeof(U8*)));
+        if (~((Usize)next_page) == 0) { break; }
+        bump_page_put(bump, page, alloc_size);
+        page = next_page;
+    }
+
+    bump->alloc_start = page;
+    bump->pos = (U8*)(page + alloc_size - sizeof(U8*));
 }
 
 void bump_list_dealloc(BumpList* bump) {
-    Usize alloc_size = page_size() * BUMP_PAGE_ALLOC_COUNT;
+    Usize alloc_size = bump_list_page_size(bump);
     U8* page = bump->alloc_start;
     
     while (~((Usize)page) != 0) {
         U8* next_page = *((U8**)(page + alloc_size - sizeof(U8*)));
-        vm_dealloc(page, alloc_size);
+        bump_page_put(bump, page, alloc_size);
+        page = next_page;
+    }
+}
+
+BumpMark bump_list_mark(BumpList* bump) {
+    return (BumpMark) {
+        .alloc_start = bump->alloc_start,
+        .pos = bump->pos,
+    };
+}
+
+void bump_list_restore(BumpList* bump, BumpMark mark) {
+    Usize alloc_size = bump_list_page_size(bump);
+    U8* page = bump->alloc_start;
+
+    while (page != mark.alloc_start) {
+        assert(~((Usize)page) != 0);
+        U8* next_page = *((U8**)(page + alloc_size - sizeof(U8*)));
+        bump_page_put(bump, page, alloc_size);
         page = next_page;
     }
+
+    bump->alloc_start = mark.alloc_start;
+    bump->pos = mark.pos;
+}
+
+// scratch -----------------------------------------------
+
+static _Thread_local BumpList scratch_lists[SCRATCH_COUNT];
+static _Thread_local bool scratch_ready = false;
+
+Scratch scratch_get(BumpList* const* conflicts, U32 conflict_num) {
+    if (!scratch_ready) {
+        // a first page up front, so releasing the outermost scratch doesn't
+        // hand every page back to the cache
+        for (U32 i = 0; i < SCRATCH_COUNT; ++i) {
+            scratch_lists[i] = bump_list_create();
+            bump_list_new_page(&scratch_lists[i]);
+        }
+        scratch_ready = true;
+        bump_thread_register();
+    }
+
+    for (U32 i = 0; i < SCRATCH_COUNT; ++i) {
+        BumpList* bump = &scratch_lists[i];
+        bool conflict = false;
+        for (U32 c = 0; c < conflict_num; ++c) {
+            if (conflicts[c] == bump) { conflict = true; }
+        }
+        if (!conflict) {
+            return (Scratch) { .bump = bump, .mark = { .alloc_start = bump->alloc_start, .pos = bump->pos } };
+        }
+    }
+
+    assert(false && "every scratch list conflicts, raise SCRATCH_COUNT");
+    return (Scratch) { .bump = NULL };
+}
+
+void scratch_release(Scratch scratch) {
+    // usually still on the same page
+    if (scratch.bump->alloc_start == scratch.mark.alloc_start) {
+        scratch.bump->pos = scratch.mark.pos;
+        return;
+    }
+    bump_list_restore(scratch.bump, scratch.mark);
+}
+
+void scratch_dealloc(void) {
+    if (scratch_ready) {
+        for (U32 i = 0; i < SCRATCH_COUNT; ++i) { bump_list_dealloc(&scratch_lists[i]); }
+        scratch_ready = false;
+    }
+    bump_page_cache_trim();
+}
+
+// bump range -----------------------------------------------
+
+static Usize bump_range_commit_step(VmFlags flags) {
+    if (flags & (VM_HUGE_THP | VM_HUGETLB)) { return VM_HUGE_PAGE_SIZE; }
+    return page_size() * BUMP_PAGE_ALLOC_COUNT;
+}
+
+BumpRange bump_range_create(void) {
+    return bump_range_create_flags(BUMP_RANGE_RESERVE, 0);
+}
+
+BumpRange bump_range_create_flags(Usize reserve, VmFlags flags) {
+    reserve = vm_flags_size(reserve, flags);
+    U8* start = vm_reserve_flags(reserve, flags);
+    if (start == MAP_FAILED) { return (BumpRange) { .start = NULL }; }
+
+    return (BumpRange) {
+        .start = start,
+        .pos = start,
+        .committed = start,
+        .end = start + reserve,
+        .flags = flags,
+    };
+}
+
+void* bump_range_alloc(BumpRange* bump, Usize size, Usize align) {
+    if (size == 0) { return NULL; }
+
+    // aligning can pass end if align is larger than the reservation's alignment
+    U8* aligned = ALIGN_TO(bump->pos + align - 1, align);
+    if (aligned > bump->end || size > (Usize)(bump->end - aligned)) { return NULL; }
+    U8* new_pos = aligned + size;
+
+    if (new_pos > bump->committed) {
+        Usize step = bump_range_commit_step(bump->flags);
+        Usize commit_end = ((Usize)(new_pos - bump->start) + step - 1) & ~(step - 1);
+        U8* new_committed = bump->start + commit_end;
+        if (new_committed > bump->end) { new_committed = bump->end; }
+
+        if (vm_commit_flags(bump->committed, (Usize)(new_committed - bump->committed), bump->flags) != 0) {
+            return NULL;
+        }
+        bump->committed = new_committed;
+    }
+
+    bump->pos = new_pos;
+    return (void*) aligned;
+}
+
+void bump_range_clear(BumpRange* bump) {
+    bump->pos = bump->start;
+}
+
+void bump_range_clear_trim(BumpRange* bump, Usize keep) {
+    bump->pos = bump->start;
+
+    Usize step = bump_range_commit_step(bump->flags);
+    keep = (keep + step - 1) & ~(step - 1);
+    if (keep >= (Usize)(bump->committed - bump->start)) { return; }
+
+    U8* keep_end = bump->start + keep;
+    vm_decommit(keep_end, (Usize)(bump->committed - keep_end));
+    bump->committed = keep_end;
+}
+
+void bump_range_dealloc(BumpRange* bump) {
+    vm_dealloc(bump->start, (Usize)(bump->end - bump->start));
 }
 
 // arena --------------------------------------------------------
 
-ArenaTracking arena_tracking_create(void) {
+#define ARENA_FREE_WORDS (ARENA_MAX_ELEMENTS / 64)
+#define ARENA_SUMMARY_WORDS ((ARENA_FREE_WORDS + 63) / 64)
+#define ARENA_TOP_WORDS ((ARENA_SUMMARY_WORDS + 63) / 64)
+
+static Usize arena_page_align(Usize size) {
+    return (size + page_size() - 1) & ~(page_size() - 1);
+}
+
+// free, free_summary, free_top, then generations, each page aligned
+Usize arena_tracking_size(void) {
+    return arena_page_align(ARENA_FREE_WORDS * sizeof(U64))
+        + arena_page_align(ARENA_SUMMARY_WORDS * sizeof(U64))
+        + arena_page_align(ARENA_TOP_WORDS * sizeof(U64))
+        + arena_page_align(ARENA_MAX_ELEMENTS * sizeof(ArenaGen));
+}
+
+static ArenaTracking arena_tracking_create_at_flags(void* mem, VmFlags flags);
+
+// the summaries are small enough to commit up front, free is NULL if that fails
+ArenaTracking arena_tracking_create_at(void* mem) {
+    return arena_tracking_create_at_flags(mem, 0);
+}
+
+static ArenaTracking arena_tracking_create_at_flags(void* mem, VmFlags flags) {
+    U8* free = mem;
+    U8* free_summary = free + arena_page_align(ARENA_FREE_WORDS * sizeof(U64));
+    U8* free_top = free_summary + arena_page_align(ARENA_SUMMARY_WORDS * sizeof(U64));
+    U8* generations = free_top + arena_page_align(ARENA_TOP_WORDS * sizeof(U64));
+    if (vm_commit_flags(free_summary, ARENA_SUMMARY_WORDS * sizeof(U64), flags) != 0
+            || vm_commit_flags(free_top, ARENA_TOP_WORDS * sizeof(U64), flags) != 0) {
+        return (ArenaTracking) { .free = NULL, .flags = flags };
+    }
+
     return (ArenaTracking) {
-        .free = vm_alloc(ARENA_MAX_ELEMENTS / 8),
-        .generations = vm_alloc(ARENA_MAX_ELEMENTS * sizeof(ArenaGen)),
+        .free = (U64*)(void*)free,
+        .free_summary = (U64*)(void*)free_summary,
+        .free_top = (U64*)(void*)free_top,
+        .generations = (ArenaGen*)(void*)generations,
         .element_num = 0,
+        .committed = 0,
+        .flags = flags,
     };
 }
 
+ArenaTracking arena_tracking_create(void) {
+    return arena_tracking_create_flags(0);
+}
+
+ArenaTracking arena_tracking_create_flags(VmFlags flags) {
+    Usize size = arena_tracking_size();
+    void* mem = vm_reserve_flags(size, flags);
+    if (mem == MAP_FAILED) { return (ArenaTracking) { .free = NULL, .flags = flags }; }
+
+    ArenaTracking ar = arena_tracking_create_at_flags(mem, flags);
+    if (ar.free == NULL) { vm_dealloc(mem, vm_flags_size(size, flags)); }
+    return ar;
+}
+
 void arena_tracking_reset(ArenaTracking* ar) {
-    memset(ar->free, 0, ARENA_MAX_ELEMENTS / 8);
-    memset(ar->generations, 0, ARENA_MAX_ELEMENTS * sizeof(ArenaGen));
+    memset(ar->free, 0, ar->committed / 8);
+    memset(ar->free_summary, 0, ARENA_SUMMARY_WORDS * sizeof(U64));
+    memset(ar->free_top, 0, ARENA_TOP_WORDS * sizeof(U64));
+    memset(ar->generations, 0, ar->committed * sizeof(ArenaGen));
     ar->element_num = 0;
 }
 
-// returns ARENA_INVALID_IDX on fail
-static ArenaIdx find_next_unused(U64* free, U64* end) {
-    ArenaIdx idx = 0;
-    while (true) {
-        U64 mask = *free;
-        if (mask != 0) {
-            idx += lowest_bit_idx(mask);
-            return idx;
-        }
+// Doubles the committed slots.
+// returns 0 on success, 1 on failure
+static int arena_tracking_commit(ArenaTracking* ar) {
+    U64 old = ar->committed;
+    U64 committed = old == 0 ? ARENA_COMMIT_MIN : old * 2;
+    if (committed > ARENA_MAX_ELEMENTS) { committed = ARENA_MAX_ELEMENTS; }
+
+    if (vm_commit_grow(ar->free, old / 8, committed / 8, ar->flags) != 0) { return 1; }
+    if (vm_commit_grow(ar->generations, old * sizeof(ArenaGen), committed * sizeof(ArenaGen), ar->flags) != 0) { return 1; }
+    ar->committed = (U32)committed;
+    return 0;
+}
 
-        if (free == end) { return ARENA_INVALID_IDX; }
-        free += 1;
-        idx += 64;
+// returns ARENA_INVALID_IDX on fail
+static ArenaIdx find_next_unused(ArenaTracking* ar) {
+    U64 top_words = (U64)ar->element_num / (64 * 64 * 64) + 1;
+    for (U64 t = 0; t < top_words; ++t) {
+        U64 top = ar->free_top[t];
+        if (top == 0) { continue; }
+
+        U64 s = t * 64 + lowest_bit_idx(top);
+        U64 w = s * 64 + lowest_bit_idx(ar->free_summary[s]);
+        return (ArenaIdx)(w * 64 + lowest_bit_idx(ar->free[w]));
     }
+    return ARENA_INVALID_IDX;
 }
 
 ArenaKey arena_tracking_insert(ArenaTracking* ar) {
-    ArenaIdx idx = find_next_unused(ar->free, &ar->free[ar->element_num / 64]);
+    ArenaIdx idx = find_next_unused(ar);
 
     if (idx == ARENA_INVALID_IDX) {
         idx = ar->element_num;
-        assert(idx != ARENA_INVALID_IDX);
+        assert(idx != ARENA_INVALID_IDX && idx < ARENA_MAX_ELEMENTS);
+        if (idx == ar->committed && arena_tracking_commit(ar) != 0) {
+            return (ArenaKey) { .idx = ARENA_INVALID_IDX, .gen = 0 };
+        }
         ar->element_num += 1;
     } else {
-        ar->free[idx / 64] &= ~(1ul << (idx % 64));
+        // clear the summary bits of words that became full
+        U64 w = idx / 64;
+        ar->free[w] &= ~(1ul << (idx % 64));
+        if (ar->free[w] == 0) {
+            ar->free_summary[w / 64] &= ~(1ul << (w % 64));
+            if (ar->free_summary[w / 64] == 0) {
+                ar->free_top[w / (64 * 64)] &= ~(1ul << ((w / 64) % 64));
+            }
+        }
     }
 
     ArenaGen gen = ar->generations[idx]+1;
@@ -523,11 +2116,7 @@ F32 arena_utilization(ArenaTracking* ar) {
     U64 last = ((U64)ar->element_num + 63) / 64;
 
     for (U64 i = 0; i < last; ++i) {
-        U64 free = ar->free[i];
-        while (free != 0) {
-            free ^= free & ((~free) + 1);
-            free_count += 1;
-        }
+        free_count += (U32)__builtin_popcountll(ar->free[i]);
     }
 
     return (F32)(ar->element_num - free_count) / (F32)ar->element_num;
@@ -541,48 +2130,187 @@ void arena_tracking_remove(ArenaTracking* ar, ArenaKey key) {
     U64 idx = key.idx;
     if (!arena_tracking_key_valid(ar, key)) return;
     ar->generations[idx] += 1;
-    ar->free[idx / 64] |= (1ul << (idx % 64));
+    U64 w = idx / 64;
+    ar->free[w] |= (1ul << (idx % 64));
+    ar->free_summary[w / 64] |= (1ul << (w % 64));
+    ar->free_top[w / (64 * 64)] |= (1ul << ((w / 64) % 64));
 }
 
 void arena_tracking_dealloc(ArenaTracking* ar) {
-    vm_dealloc(ar->free, ARENA_MAX_ELEMENTS / 8);
-    vm_dealloc(ar->generations, ARENA_MAX_ELEMENTS * sizeof(ArenaGen));
+    vm_dealloc(ar->free, vm_flags_size(arena_tracking_size(), ar->flags));
+}
+
+static inline U64 arena_live_bits(ArenaTracking* ar, U32 w) {
+    U64 live = ~ar->free[w];
+    U64 end = (U64)ar->element_num - (U64)w * 64;
+    if (end < 64) { live &= (1ul << end) - 1; }
+    return live;
+}
+
+U64 arena_live_word(ArenaTracking* ar, U32 w) {
+    return arena_live_bits(ar, w);
+}
+
+U64 arena_live_word_next(ArenaTracking* ar, U64* w) {
+    U64 words = ((U64)ar->element_num + 63) / 64;
+    while (*w + 1 < words) {
+        *w += 1;
+        U64 live = arena_live_bits(ar, (U32)*w);
+        if (live != 0) { return live; }
+    }
+    return 0;
 }
 
 ArenaIter arena_iter(ArenaTracking* ar) {
     return (ArenaIter) {
         .ar = ar,
-        .idx = 0,
+        .word = 0,
+        .live = ar->element_num == 0 ? 0 : arena_live_bits(ar, 0),
     };
 }
 
 ArenaKey arena_iter_next(ArenaIter* iter) {
-    ArenaIdx idx = iter->idx;
     ArenaTracking* ar = iter->ar;
-    ArenaIdx element_num = ar->element_num;
-    U64* free = ar->free;
-    while (true) {
-        if (idx == element_num) { 
+    U32 words = ((U32)ar->element_num + 63) / 64;
+
+    // skips fully free words
+    while (iter->live == 0) {
+        iter->word += 1;
+        if (iter->word >= words) {
+            iter->word = words;
             return (ArenaKey) {
                 .idx = ARENA_INVALID_IDX,
                 .gen = 0,
             };
         }
+        iter->live = arena_live_bits(ar, iter->word);
+    }
 
-        U64 mask = free[idx / 64];
-        if ((mask & (1ul << (idx % 64))) == 0) {
-            iter->idx = idx+1;
-            break;
+    ArenaIdx idx = (ArenaIdx)(iter->word * 64 + lowest_bit_idx(iter->live));
+    iter->live &= iter->live - 1;
+
+    return (ArenaKey) {
+        .gen = ar->generations[idx],
+        .idx = idx,
+    };
+}
+
+// thread safe arena -------------------------------------------
+
+// Clears bit in a summary word whose child word was seen empty. A remove may
+// have set a bit in the child meanwhile, so the summary bit is set again if
+// the child is not empty anymore.
+// returns true if the summary word became empty
+static bool arena_clear_hint(U64* summary, U64 bit, U64* child) {
+    U64 old = __atomic_fetch_and(summary, ~bit, __ATOMIC_ACQ_REL);
+    if (__atomic_load_n(child, __ATOMIC_ACQUIRE) != 0) {
+        __atomic_fetch_or(summary, bit, __ATOMIC_RELEASE);
+        return false;
+    }
+    return (old & ~bit) == 0;
+}
+
+static void arena_clear_word_hints(ArenaTracking* ar, U64 w) {
+    U64 s = w / 64;
+    if (arena_clear_hint(&ar->free_summary[s], 1ul << (w % 64), &ar->free[w])) {
+        arena_clear_hint(&ar->free_top[s / 64], 1ul << (s % 64), &ar->free_summary[s]);
+    }
+}
+
+// returns ARENA_INVALID_IDX if no slot below element_num is free
+static ArenaIdx arena_claim_free(ArenaTracking* ar) {
+    U64 element_num = __atomic_load_n(&ar->element_num, __ATOMIC_ACQUIRE);
+    U64 top_words = element_num / (64 * 64 * 64) + 1;
+    for (U64 t = 0; t < top_words; ++t) {
+        while (true) {
+            U64 top = __atomic_load_n(&ar->free_top[t], __ATOMIC_ACQUIRE);
+            if (top == 0) { break; }
+
+            U64 s = t * 64 + lowest_bit_idx(top);
+            U64 summary = __atomic_load_n(&ar->free_summary[s], __ATOMIC_ACQUIRE);
+            if (summary == 0) {
+                arena_clear_hint(&ar->free_top[t], 1ul << (s % 64), &ar->free_summary[s]);
+                continue;
+            }
+
+            U64 w = s * 64 + lowest_bit_idx(summary);
+            U64 word = __atomic_load_n(&ar->free[w], __ATOMIC_ACQUIRE);
+            while (word != 0) {
+                U64 bit = word & (~word + 1);
+                if (__atomic_compare_exchange_n(&ar->free[w], &word, word & ~bit, false,
+                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                    if ((word & ~bit) == 0) { arena_clear_word_hints(ar, w); }
+                    return (ArenaIdx)(w * 64 + lowest_bit_idx(bit));
+                }
+            }
+
+            // other inserts took every bit
+            arena_clear_word_hints(ar, w);
         }
+    }
+    return ARENA_INVALID_IDX;
+}
 
-        idx += 1;
+// Commits memory up to slot idx. Threads racing here may commit the same
+// pages, which is harmless, and committed only ever grows.
+// returns 0 on success, 1 on failure
+static int arena_tracking_commit_atomic(ArenaTracking* ar, U64 idx) {
+    U32 committed = __atomic_load_n(&ar->committed, __ATOMIC_ACQUIRE);
+    if (idx < committed) { return 0; }
+
+    U64 target = committed == 0 ? ARENA_COMMIT_MIN : committed;
+    while (target <= idx) { target *= 2; }
+    if (target > ARENA_MAX_ELEMENTS) { target = ARENA_MAX_ELEMENTS; }
+
+    if (vm_commit_grow(ar->free, committed / 8, target / 8, ar->flags) != 0) { return 1; }
+    if (vm_commit_grow(ar->generations, (Usize)committed * sizeof(ArenaGen), target * sizeof(ArenaGen), ar->flags) != 0) { return 1; }
+    while (committed < target && !__atomic_compare_exchange_n(&ar->committed, &committed, (U32)target,
+            false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {}
+    return 0;
+}
+
+ArenaKey arena_tracking_insert_atomic(ArenaTracking* ar) {
+    ArenaIdx idx = arena_claim_free(ar);
+
+    if (idx == ARENA_INVALID_IDX) {
+        // commit before taking the slot, so element_num never passes committed memory
+        idx = __atomic_load_n(&ar->element_num, __ATOMIC_ACQUIRE);
+        do {
+            assert(idx != ARENA_INVALID_IDX && idx < ARENA_MAX_ELEMENTS);
+            if (arena_tracking_commit_atomic(ar, idx) != 0) {
+                return (ArenaKey) { .idx = ARENA_INVALID_IDX, .gen = 0 };
+            }
+        } while (!__atomic_compare_exchange_n(&ar->element_num, &idx, (ArenaIdx)(idx + 1), false,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
     }
 
-    ArenaGen gen = ar->generations[idx];
+    ArenaGen gen = __atomic_add_fetch(&ar->generations[idx], 1, __ATOMIC_RELEASE);
+
     return (ArenaKey) {
-        .gen = gen,
         .idx = idx,
+        .gen = gen,
     };
 }
 
+bool arena_tracking_key_valid_atomic(ArenaTracking* ar, ArenaKey key) {
+    return __atomic_load_n(&ar->generations[key.idx], __ATOMIC_ACQUIRE) == key.gen;
+}
+
+// the generation moves before the slot is marked free, so it can't be
+// claimed by an insert while the old key still looks valid
+bool arena_tracking_remove_atomic(ArenaTracking* ar, ArenaKey key) {
+    U64 idx = key.idx;
+    ArenaGen gen = key.gen;
+    if (!__atomic_compare_exchange_n(&ar->generations[idx], &gen, (ArenaGen)(gen + 1), false,
+            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        return false;
+    }
+
+    U64 w = idx / 64;
+    __atomic_fetch_or(&ar->free[w], 1ul << (idx % 64), __ATOMIC_RELEASE);
+    __atomic_fetch_or(&ar->free_summary[w / 64], 1ul << (w % 64), __ATOMIC_RELEASE);
+    __atomic_fetch_or(&ar->free_top[w / (64 * 64)], 1ul << ((w / 64) % 64), __ATOMIC_RELEASE);
+    return true;
+}
+
 #endif
@@ -11,6 +11,10 @@
 #include <sys/mman.h>
 #include <time.h>
 #include <math.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 
 typedef uint64_t U64;
 typedef uint32_t U32;
@@ -36,7 +40,9 @@ U32 round_pow_2(U32 n);
 
 // returns index of lowest set bit
 // UB if n is zero
-U8 lowest_bit_idx(U64 n);
+static inline U8 lowest_bit_idx(U64 n) {
+    return (U8)__builtin_ctzll(n);
+}
 
 // MATH -----------------------------------------------------------------------
 
@@ -202,30 +208,152 @@ int segment_next(StringSegment* l, char separator);
 
 // HASHING -----------------------------------------------------------
 
+// Bumped whenever HASH changes output.
+// Saved tables record it, since their keys are only valid for the same hash.
+#define HASH_VERSION 1
+
+// murmur 3, the fixed size versions are inline so hashing a 4, 8 or 16 byte
+// key runs no loop
+static inline U32 murmur_32_scramble(U32 k) {
+    k *= 0xcc9e2d51;
+    k = (k << 15) | (k >> 17);
+    k *= 0x1b873593;
+    return k;
+}
+
+static inline U32 murmur_32_block(U32 h, U32 k) {
+    h ^= murmur_32_scramble(k);
+    h = (h << 13) | (h >> 19);
+    return h * 5 + 0xe6546b64;
+}
+
+// k holds the last len & 3 bytes
+static inline U32 murmur_32_finish(U32 h, U32 k, U64 len) {
+    h ^= murmur_32_scramble(k);
+    h ^= (U32)len;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+#define MURMUR_32_SEED 0x1b873593
+
+U32 hash_bytes(const U8* key, U64 len);
+
+static inline U32 hash_bytes_4(const void* key) {
+    U32 k;
+    memcpy(&k, key, sizeof(k));
+    return murmur_32_finish(murmur_32_block(MURMUR_32_SEED, k), 0, 4);
+}
+
+static inline U32 hash_bytes_8(const void* key) {
+    U32 k[2];
+    memcpy(k, key, sizeof(k));
+    U32 h = murmur_32_block(MURMUR_32_SEED, k[0]);
+    h = murmur_32_block(h, k[1]);
+    return murmur_32_finish(h, 0, 8);
+}
+
+static inline U32 hash_bytes_16(const void* key) {
+    U32 k[4];
+    memcpy(k, key, sizeof(k));
+    U32 h = MURMUR_32_SEED;
+    h = murmur_32_block(h, k[0]);
+    h = murmur_32_block(h, k[1]);
+    h = murmur_32_block(h, k[2]);
+    h = murmur_32_block(h, k[3]);
+    return murmur_32_finish(h, 0, 16);
+}
+
+// Define HASH_KEY_64 for 64 bit keys hashed with hash_bytes_64, so collisions
+// stay rare with hundreds of millions of keys. tools.c and everything
+// including tools.h must agree on it.
+#ifdef HASH_KEY_64
+typedef U64 HashKey;
+#define HASH(t) hash_bytes_64((const U8*)&(t), sizeof(t))
+#else
 typedef U32 HashKey;
+#define HASH(t) (sizeof(t) == 4 ? hash_bytes_4(&(t)) \
+    : sizeof(t) == 8 ? hash_bytes_8(&(t)) \
+    : sizeof(t) == 16 ? hash_bytes_16(&(t)) \
+    : hash_bytes((const U8*)&(t), sizeof(t)))
+#endif
+
+// HASH of n keys at once, 16 U32 or 8 U64 keys per step with AVX2 when the
+// cpu has it. Only 32 bit keys are vectorized.
+void hash_u32_batch(const U32* keys, HashKey* out, U64 n);
+void hash_u64_batch(const U64* keys, HashKey* out, U64 n);
+
+// wyhash style, 48 bytes per step. Much faster than hash_bytes on long keys.
+U64 hash_bytes_64(const U8* key, U64 len);
+U64 hash_bytes_64_seed(const U8* key, U64 len, U64 seed);
+
+// Streaming hashes, for keys split across buffers or made of several fields.
+// Updating with the bytes in any number of pieces gives the same result as
+// hash_bytes or hash_bytes_64_seed over all of them at once.
+
+typedef struct {
+    U32 h;
+    U32 buf_len;
+    U64 len;
+    U8 buf[4];
+} HashState;
+
+HashState hash_state_init(void);
+void hash_state_update(HashState* state, const U8* data, U64 len);
+U32 hash_state_finish(HashState* state);
+
+typedef struct {
+    U64 seed;
+    U64 seed1;
+    U64 seed2;
+    U64 len;
+    U32 buf_len;
+    U8 buf[64];     // 16 bytes already hashed, then up to 48 pending
+} HashState64;
 
-// murmur 3
-#define HASH(t) hash_bytes((U8*)&t, sizeof(t))
-HashKey murmur_32_scramble(U32 k);
-HashKey hash_bytes(const U8* key, U64 len);
+HashState64 hash_state_64_init(U64 seed);
+void hash_state_64_update(HashState64* state, const U8* data, U64 len);
+U64 hash_state_64_finish(HashState64* state);
 
 // hash set -------------------------------------------------------------------
 
+// The table grows once live keys plus tombstones would pass max_load,
+// so there is always an empty slot to stop probing on.
+#define SET_DEFAULT_MAX_LOAD 0.875f
+
 typedef struct {
     HashKey* keys;
     U32 mask;
+    U32 count;          // live keys
+    U32 tombstones;     // removed keys still taking a slot
+    U32 grow_at;        // rehash once count + tombstones would pass this
+    F32 max_load;
 } Set;
 
-// allows for at least size elements
+// allows for at least size elements before growing
 Set set_create(U32 size);
 
-// TODO: prevent infinite lookup loops when all elements in keys are nonzero
+// max_load must be in (0, 1]
+Set set_create_load(U32 size, F32 max_load);
 
 // high half is key index, or first available index
 // low half is 1 if found, 0 if not found
 U64 set_lookup(Set* set, HashKey key);
 
+// How many keys ahead batched lookups prefetch.
+// Enough to overlap the cache misses of a table bigger than the cache.
+#define SET_PREFETCH_DISTANCE 32
+
+// set_lookup for n keys, results in out.
+// Prefetches the home slots of later keys while resolving earlier ones.
+void set_lookup_batch(Set* set, const HashKey* keys, U64* out, U32 n);
+
 // returns index in backing array
+// grows the set if needed, which moves keys. Use set_reserve to move values along with them.
 U32 set_insert(Set* set, HashKey key);
 
 // high half is key index, or first available index
@@ -233,6 +361,202 @@ U32 set_insert(Set* set, HashKey key);
 U64 set_remove(Set* set, HashKey key);
 void set_dealloc(Set* set);
 
+// Values is an optional array of value_size elements parallel to keys,
+// moved along with the keys. Returns the new values array (the old one is freed).
+
+// rehashes if inserting additional more keys would pass max_load.
+// Grows to the next power of 2, or rehashes at the same size if most slots are tombstones.
+void* set_reserve(Set* set, U32 additional, void* values, Usize value_size);
+
+// rebuilds the table with room for at least size elements, dropping tombstones
+void* set_rehash(Set* set, U32 size, void* values, Usize value_size);
+
+// sizing used by Set, for tables that rebuild themselves (map.h, key_map.h)
+
+// size set_reserve rehashes to
+U32 set_grow_size(U32 count, U32 grow_at, U32 additional);
+
+// mask of the smallest table holding size keys below max_load, at least min_mask
+U32 set_mask_for(U32 size, F32 max_load, U32 min_mask);
+
+// most keys a table holds before growing, always leaves an empty slot
+U32 set_load_limit(U32 mask, F32 max_load);
+
+// Stats. Probe length is how many slots a successful lookup of a key checks.
+
+#define SET_PROBE_HISTOGRAM 16
+
+typedef struct {
+    U32 slots;
+    U32 count;
+    U32 tombstones;
+    F32 load;               // (count + tombstones) / slots
+    F32 avg_probe;
+    U32 max_probe;
+    F32 expected_probe;     // average probe length of a uniform hash at this load
+    U32 max_cluster;        // longest run of used slots
+    U32 histogram[SET_PROBE_HISTOGRAM];     // keys by probe length - 1, the last entry counts longer probes
+    bool clustered;         // probes are much longer than expected, probably a weak hash
+} SetStats;
+
+// walks the whole table
+SetStats set_stats(Set* set);
+// set_stats for a linear probing table whose keys are stride bytes apart,
+// like the buckets of a HASH_MAP_INLINE map
+SetStats set_stats_stride(const void* keys, Usize stride, U32 mask, U32 count, U32 tombstones);
+
+// Counters of every lookup and insert on this thread.
+// Only counted if tools.c is compiled with -DSET_COUNTERS, otherwise always zero.
+
+typedef struct {
+    U64 lookups;
+    U64 inserts;
+    U64 probes;     // slots (Set) or groups (GroupSet) checked by lookups and inserts
+    U64 rehashes;
+} SetCounters;
+
+SetCounters set_counters(void);
+void set_counters_reset(void);
+
+// Snapshots. A header, keys, then values, each 64 byte aligned, written as is.
+// Opening maps the file read-only and uses the arrays in place, so the set
+// and values must not be modified. Processes opening the same file share pages.
+
+#define SET_SNAPSHOT_MAGIC 0x544553534c4f4f54ul   // "TOOLSSET"
+#define SET_SNAPSHOT_VERSION 1
+
+typedef struct {
+    U64 magic;
+    U32 version;
+    U32 hash_version;
+    U32 key_size;
+    U32 mask;
+    U32 count;
+    U32 tombstones;
+    U64 value_size;
+    U8 padding[24];
+} SetSnapshotHeader;
+
+// values may be NULL if value_size is 0
+// returns 0 on success, 1 on failure
+int set_save(Set* set, const void* values, Usize value_size, const char* path);
+
+// Fails if the file was saved with a different value_size, key size, or hash.
+// values is set to the mapped values array, or NULL if value_size is 0.
+// returns 0 on success, 1 on failure
+int set_open_mmap(Set* set, void** values, Usize value_size, const char* path);
+
+// unmaps a set opened with set_open_mmap, instead of set_dealloc
+void set_close_mmap(Set* set, Usize value_size);
+
+// Backward shift deletion. Instead of leaving a tombstone, later keys in the
+// cluster move back into the hole, so churn doesn't lengthen probes.
+// Moves keys, values is an optional parallel array moved along with them.
+// Safe to mix with set_remove.
+
+// high half is the index the key was at, or first available index
+// low half is 1 if found, 0 if not found
+U64 set_remove_shift(Set* set, HashKey key, void* values, Usize value_size);
+
+// removes the key at idx
+void set_remove_at(Set* set, U32 idx, void* values, Usize value_size);
+
+// group probed hash set ------------------------------------------------------
+
+// Swiss table layout. Every slot has a control byte that is either empty,
+// deleted, or the top 7 bits of the key. A probe compares GROUP_WIDTH
+// control bytes at once, and only touches keys whose control byte matches.
+// keys uses the same 0 (empty) and 1 (removed) convention as Set,
+// and grows the same way.
+
+#define GROUP_WIDTH 16
+#define GROUP_CTRL_EMPTY (U8)0x80
+#define GROUP_CTRL_DELETED (U8)0xFE
+
+typedef struct {
+    U8* ctrl;       // mask+1+GROUP_WIDTH bytes, the first group is mirrored at the end
+    HashKey* keys;
+    U32 mask;
+    U32 count;
+    U32 tombstones;
+    U32 grow_at;
+    F32 max_load;
+} GroupSet;
+
+// allows for at least size elements before growing
+GroupSet group_set_create(U32 size);
+GroupSet group_set_create_load(U32 size, F32 max_load);
+
+// high half is key index, or first available index
+// low half is 1 if found, 0 if not found
+U64 group_set_lookup(GroupSet* set, HashKey key);
+void group_set_lookup_batch(GroupSet* set, const HashKey* keys, U64* out, U32 n);
+
+// returns index in backing array
+U32 group_set_insert(GroupSet* set, HashKey key);
+
+// high half is key index, or first available index
+// low half is 1 if found, 0 if not found
+U64 group_set_remove(GroupSet* set, HashKey key);
+void group_set_dealloc(GroupSet* set);
+
+void* group_set_reserve(GroupSet* set, U32 additional, void* values, Usize value_size);
+void* group_set_rehash(GroupSet* set, U32 size, void* values, Usize value_size);
+
+// probe lengths are in groups rather than slots
+SetStats group_set_stats(GroupSet* set);
+
+// concurrent hash set -------------------------------------------------------
+
+// Lookups are wait-free, inserts claim slots with compare and swap, and
+// removes leave tombstones that aren't reused until the table is rebuilt.
+// A value of value_size bytes is stored with each key (0 for a plain set),
+// written once by the insert that claims the slot.
+//
+// Growing freezes the table. The writer that froze it waits for writers
+// already inside to finish, copies it into a new table and publishes it.
+// Other writers wait for the new table, lookups keep reading the frozen one.
+// Replaced tables stay readable until concurrent_set_reclaim.
+
+typedef struct ConcurrentSetTable {
+    HashKey* keys;
+    U8* values;
+    U8* ready;          // 1 once the slot's value is written
+    U32 mask;
+    U32 grow_at;
+    U32 used;           // claimed slots, live keys plus tombstones
+    U32 removed;
+    U32 writers;        // inserts and removes in progress
+    U32 frozen;         // 1 once growing started
+    struct ConcurrentSetTable* retired;
+} ConcurrentSetTable;
+
+typedef struct {
+    ConcurrentSetTable* table;
+    Usize value_size;
+    F32 max_load;
+} ConcurrentSet;
+
+// allows for at least size elements before growing
+ConcurrentSet concurrent_set_create(U32 size, Usize value_size);
+
+// Returns the key's value, or NULL if not found.
+// With value_size 0, returns non NULL if found.
+// The value is never modified, but may belong to a key removed after the lookup.
+void* concurrent_set_lookup(ConcurrentSet* set, HashKey key);
+
+// copies value_size bytes of value, which may be NULL for a plain set
+// returns false if the key already exists, the existing value is kept
+bool concurrent_set_insert(ConcurrentSet* set, HashKey key, const void* value);
+
+// returns false if not found
+bool concurrent_set_remove(ConcurrentSet* set, HashKey key);
+
+// Frees replaced tables.
+// No other thread may use the set or hold a value pointer during this call.
+void concurrent_set_reclaim(ConcurrentSet* set);
+void concurrent_set_dealloc(ConcurrentSet* set);
+
 // PRNG -----------------------------------------------------------------------
 
 extern U64 PRNG_SEEDS[256];
@@ -275,6 +599,79 @@ Usize page_size(void);
 void* vm_alloc(Usize size);
 int vm_dealloc(void* ptr, Usize size);
 
+// Reserves address space only. Touching it faults until it is committed.
+// Free with vm_dealloc.
+void* vm_reserve(Usize size);
+
+// Makes reserved memory readable and writable, zero filled on first touch.
+// ptr must be page aligned, size is rounded up to whole pages.
+// Committing memory again is a no op.
+int vm_commit(void* ptr, Usize size);
+
+// Options for the _flags versions.
+// VM_HUGE_THP aligns to VM_HUGE_PAGE_SIZE and asks for transparent huge pages.
+// VM_HUGETLB maps from the huge page pool, the size must be a multiple of
+// VM_HUGE_PAGE_SIZE. It falls back to VM_HUGE_THP when the pool is empty, and
+// reservations always use VM_HUGE_THP instead, since hugetlb memory can't be
+// committed a page at a time.
+// VM_POPULATE faults the memory in up front instead of on first touch.
+typedef U32 VmFlags;
+#define VM_HUGE_THP 1u
+#define VM_HUGETLB  2u
+#define VM_POPULATE 4u
+#define VM_HUGE_PAGE_SIZE ((Usize)2 << 20)
+
+// size actually mapped by the _flags versions, pass it to vm_dealloc
+static inline Usize vm_flags_size(Usize size, VmFlags flags) {
+    if (!(flags & (VM_HUGE_THP | VM_HUGETLB))) { return size; }
+    return (size + VM_HUGE_PAGE_SIZE - 1) & ~(VM_HUGE_PAGE_SIZE - 1);
+}
+
+void* vm_alloc_flags(Usize size, VmFlags flags);
+// align must be a power of 2, free with vm_dealloc(ptr, size)
+void* vm_alloc_aligned(Usize size, Usize align);
+void* vm_reserve_flags(Usize size, VmFlags flags);
+int vm_commit_flags(void* ptr, Usize size, VmFlags flags);
+// Grows a committed prefix of ptr from old_size to new_size bytes. Only the
+// pages from the one holding old_size on are committed and populated again.
+int vm_commit_grow(void* ptr, Usize old_size, Usize new_size, VmFlags flags);
+
+// Frees the memory behind committed pages, which go back to being reserved.
+// ptr must be page aligned, size is rounded up to whole pages.
+int vm_decommit(void* ptr, Usize size);
+
+// Drops the whole pages of ptr[start..end) so they read as zero again, for
+// giving back a large malloc'd buffer in pieces before freeing it. Both ends
+// are rounded down to a page, so consecutive ranges cover every whole page,
+// and nothing before ptr is touched.
+void vm_release(void* ptr, Usize start, Usize end);
+// Faults in the whole pages of ptr[start..end) without changing them, rounded
+// like vm_release, so a buffer can be paged in a piece at a time before use.
+void vm_prefault(void* ptr, Usize start, Usize end);
+
+// Reserved memory backed by a memfd and mapped private, commit it with
+// vm_commit. Writes stay private to the mapping until vm_file_save copies the
+// pages dirtied since the last save into the file, and vm_file_restore drops
+// them, going back to the saved state. Only dirtied pages take extra memory.
+// Between saves the fd holds the saved state, so it can be read from another
+// thread, for example to serialize it.
+typedef struct {
+    U8* ptr;
+    Usize size;
+    int fd;
+} VmFile;
+
+// fd is -1 on failure
+VmFile vm_file_reserve(Usize size);
+// returns 0 on success, 1 on failure
+int vm_file_save(VmFile* file);
+int vm_file_restore(VmFile* file);
+// only the pages overlapping [offset, offset + size), which is cheaper when
+// most of a large reservation was never committed
+int vm_file_save_range(VmFile* file, Usize offset, Usize size);
+int vm_file_restore_range(VmFile* file, Usize offset, Usize size);
+void vm_file_dealloc(VmFile* file);
+
 // bump -----------------------------------------------
 
 // Memory not contiguous
@@ -282,6 +679,7 @@ int vm_dealloc(void* ptr, Usize size);
 typedef struct {
     U8* alloc_start;
     U8* pos;  
+    VmFlags flags;
 } BumpList;
 
 #define BUMP_PAGE_ALLOC_COUNT 32
@@ -290,36 +688,163 @@ typedef struct {
 #define BUMP_LIST_ALLOC_ARRAY(bump, type, size) ((type*) bump_list_alloc(bump, sizeof(type)*size, alignof(type)))
 
 BumpList bump_list_create(void);
+// With VM_HUGE_THP or VM_HUGETLB pages are VM_HUGE_PAGE_SIZE instead of
+// BUMP_PAGE_ALLOC_COUNT system pages.
+BumpList bump_list_create_flags(VmFlags flags);
 
 void bump_list_new_page(BumpList* bump);
 
 // alignment must be a power of 2
 void* bump_list_alloc(BumpList* bump, Usize size, Usize align);
 void bump_list_clear(BumpList* bump);
+// the pages go to this thread's page cache, see below
 void bump_list_dealloc(BumpList* bump);
 
+// Position to roll back to, marks nest like a stack.
+typedef struct {
+    U8* alloc_start;
+    U8* pos;
+} BumpMark;
+
+BumpMark bump_list_mark(BumpList* bump);
+// Frees everything allocated since mark, releasing the pages made after it.
+// Later marks become invalid.
+void bump_list_restore(BumpList* bump, BumpMark mark);
+
+// Pages released by clear, restore and dealloc go to a cache on the releasing
+// thread, and new pages on that thread come from it before mapping more.
+// Pages past the cache limit are unmapped, and the cache is unmapped when the
+// thread exits. Pages taken from the cache are not zeroed, they hold whatever
+// their last list left in them.
+
+#ifndef BUMP_PAGE_CACHE_LIMIT
+#define BUMP_PAGE_CACHE_LIMIT ((Usize)16 << 20)
+#endif
+
+typedef struct {
+    U64 maps;       // pages mapped from the kernel
+    U64 unmaps;     // pages given back to the kernel
+    U64 reuses;     // pages taken from the cache
+    U64 cached;     // bytes in the cache now
+} BumpPageCounters;
+
+// counters of this thread
+BumpPageCounters bump_page_counters(void);
+void bump_page_counters_reset(void);
+// Bytes this thread keeps cached, starts at BUMP_PAGE_CACHE_LIMIT and 0
+// disables the cache. Unmaps cached pages over the new limit.
+void bump_page_cache_limit(Usize bytes);
+// unmaps every page cached by this thread now, instead of at thread exit
+void bump_page_cache_trim(void);
+
+// Per thread scratch lists for temporary memory, no locks and no setup.
+// scratch_get returns a scratch list that isn't one of conflicts, so a
+// function can take its caller's list (and allocate results there) and still
+// use scratch memory of its own. scratch_release frees everything allocated
+// from the scratch since scratch_get. Releases must happen in reverse order.
+//
+//     Scratch s = scratch_get(&out, 1);
+//     U32* tmp = bump_list_alloc(s.bump, n * sizeof(U32), sizeof(U32));
+//     ...
+//     scratch_release(s);
+
+#define SCRATCH_COUNT 2
+
+typedef struct {
+    BumpList* bump;
+    BumpMark mark;
+} Scratch;
+
+Scratch scratch_get(BumpList* const* conflicts, U32 conflict_num);
+void scratch_release(Scratch scratch);
+// Frees the scratch lists and page cache of this thread now. Threads that exit
+// free them anyway, so this is only needed to give memory back earlier.
+void scratch_dealloc(void);
+
+// Memory contiguous
+// Reserves the whole range up front and commits it as pos moves up, so
+// allocations of any size fit until the reservation runs out.
+typedef struct {
+    U8* start;
+    U8* pos;
+    U8* committed;      // end of the committed memory
+    U8* end;            // end of the reservation
+    VmFlags flags;
+} BumpRange;
+
+#ifndef BUMP_RANGE_RESERVE
+#define BUMP_RANGE_RESERVE ((Usize)64 << 30)
+#endif
+#define BUMP_RANGE_ALLOC(bump, type) ((type*) bump_range_alloc(bump, sizeof(type), alignof(type)))
+#define BUMP_RANGE_ALLOC_ARRAY(bump, type, size) ((type*) bump_range_alloc(bump, sizeof(type)*size, alignof(type)))
+
+// reserves BUMP_RANGE_RESERVE bytes
+BumpRange bump_range_create(void);
+// Commits in VM_HUGE_PAGE_SIZE steps with VM_HUGE_THP or VM_HUGETLB, otherwise
+// in BUMP_PAGE_ALLOC_COUNT pages. start is NULL on failure.
+BumpRange bump_range_create_flags(Usize reserve, VmFlags flags);
+
+// alignment must be a power of 2
+// returns NULL when the reservation is used up
+void* bump_range_alloc(BumpRange* bump, Usize size, Usize align);
+// keeps the committed memory for reuse
+void bump_range_clear(BumpRange* bump);
+// also decommits everything past the first keep bytes
+void bump_range_clear_trim(BumpRange* bump, Usize keep);
+void bump_range_dealloc(BumpRange* bump);
+
 // arena -----------------------------------------------
 
+// Arenas reserve room for ARENA_MAX_ELEMENTS up front and commit it in
+// growing chunks as element_num grows, starting at ARENA_COMMIT_MIN.
+//
+// Define ARENA_HANDLE_32 for 32 bit indices and generations, so arenas can
+// hold millions of elements. tools.c and everything including tools.h must
+// agree on it.
+#ifdef ARENA_HANDLE_32
+typedef U32 ArenaIdx;
+typedef U32 ArenaGen;
+#define ARENA_INVALID_IDX (ArenaIdx)0xFFFFFFFF
+#ifndef ARENA_MAX_ELEMENTS
+#define ARENA_MAX_ELEMENTS ((Usize)1 << 28)
+#endif
+#else
+typedef U16 ArenaIdx;
+typedef U16 ArenaGen;
 #define ARENA_PAGE_ALLOC_COUNT 16
-#define ARENA_MAX_ELEMENTS (page_size() * ARENA_PAGE_ALLOC_COUNT)
 #define ARENA_INVALID_IDX (ArenaIdx)0xFFFF
+#define ARENA_MAX_ELEMENTS (page_size() * ARENA_PAGE_ALLOC_COUNT)
+#endif
 
-typedef U16 ArenaIdx;
-typedef U16 ArenaGen;
+#define ARENA_COMMIT_MIN 4096
 
 typedef struct {
     ArenaGen gen;
     ArenaIdx idx;
 } ArenaKey;
 
+// free has a bit set for every removed slot below element_num.
+// Bit i of free_summary is set if free[i] != 0, and bit i of free_top if
+// free_summary[i] != 0, so a free slot is found with three ctz.
 typedef struct {
     U64* free;
+    U64* free_summary;
+    U64* free_top;
     ArenaGen* generations;
     ArenaIdx element_num;
+    U32 committed;      // slots with committed memory
+    VmFlags flags;      // used for the reservation and every commit
 } ArenaTracking;
 
+// free is NULL on failure
 ArenaTracking arena_tracking_create();
+ArenaTracking arena_tracking_create_flags(VmFlags flags);
+// bytes of reserved memory an ArenaTracking uses
+Usize arena_tracking_size(void);
+// mem must be arena_tracking_size() bytes from vm_reserve or vm_file_reserve
+ArenaTracking arena_tracking_create_at(void* mem);
 void arena_tracking_reset(ArenaTracking* ar);
+// the key's idx is ARENA_INVALID_IDX if memory for a new slot can't be committed
 ArenaKey arena_tracking_insert(ArenaTracking* ar);
 bool arena_key_equal(ArenaKey a, ArenaKey b);
 
@@ -328,9 +853,27 @@ bool arena_tracking_key_valid(ArenaTracking* ar, ArenaKey k);
 void arena_tracking_remove(ArenaTracking* ar, ArenaKey k);
 void arena_tracking_dealloc(ArenaTracking* ar);
 
+// Thread safe versions. Any number of threads may insert, remove and check
+// keys at once, but not together with the other ArenaTracking functions.
+// Free bits are claimed with compare and swap, and a key is removed by
+// moving its generation forward with compare and swap, so only one remove
+// of a key succeeds. The summary bitmaps are only hints here. Inserts fail
+// the same way as arena_tracking_insert.
+ArenaKey arena_tracking_insert_atomic(ArenaTracking* ar);
+bool arena_tracking_key_valid_atomic(ArenaTracking* ar, ArenaKey k);
+// returns false if k was already removed
+bool arena_tracking_remove_atomic(ArenaTracking* ar, ArenaKey k);
+
+// bit i set if slot w*64 + i is in use
+U64 arena_live_word(ArenaTracking* ar, U32 w);
+// moves w to the next word with a live slot and returns its bits, 0 past the last word
+U64 arena_live_word_next(ArenaTracking* ar, U64* w);
+
+// walks the live bits of one free word at a time
 typedef struct {
     ArenaTracking* ar;
-    ArenaIdx idx;
+    U32 word;
+    U64 live;
 } ArenaIter;
 
 ArenaIter arena_iter(ArenaTracking* ar);